@@ -0,0 +1,91 @@
+#include <cstdlib>
+#include <cstring>
+#include <map>
+#include <utility>
+//
+#include <lux_shared/common.hpp>
+//
+#include <map.hpp>
+
+///applies random face updates to a mesh and replays the chunk updates the
+///clients get on a mirrored face list, which has to match the mesh after
+///every tick
+
+typedef std::map<std::pair<ChkIdx, U8>, BlockId> RefFaces;
+
+static U32 rand_state = 1;
+
+static U32 get_rand(U32 mod) {
+    rand_state = rand_state * 1664525u + 1013904223u;
+    return (rand_state >> 8) % mod;
+}
+
+static bool is_same_face(BlockFace const& a, BlockFace const& b) {
+    return a.idx == b.idx && a.id == b.id && a.orientation == b.orientation;
+}
+
+int main() {
+    Uns constexpr TICKS     = 1000;
+    Uns constexpr MAX_OPS   = 64;
+    ///the updates hit a small part of the chunk, so most of them find a face
+    Uns constexpr HOT_BLOCKS = 512;
+
+    ChunkMesh mesh;
+    RefFaces ref;
+    for(Uns i = 0; i < 4000; ++i) {
+        ChkIdx idx = get_rand(CHK_VOL);
+        U8 axis    = get_rand(3);
+        if(ref.count({idx, axis}) > 0) continue;
+        ref[{idx, axis}] = 1;
+        mesh.faces.push({idx, 1, (U8)(axis << 1)});
+    }
+    DynArr<BlockFace> client;
+    for(auto const& face : mesh.faces) {
+        client.push(face);
+    }
+
+    for(Uns tick = 0; tick < TICKS; ++tick) {
+        Uns ops = get_rand(MAX_OPS);
+        for(Uns i = 0; i < ops; ++i) {
+            ChkIdx idx = get_rand(HOT_BLOCKS);
+            U8 axis    = get_rand(3);
+            bool had_face = ref.count({idx, axis}) > 0;
+            if(mesh.remove_face(idx, axis) != had_face) {
+                LUX_FATAL("tick %u: remove_face disagrees with the reference",
+                          tick);
+            }
+            ref.erase({idx, axis});
+            if(get_rand(2) == 0) {
+                BlockId id = 1 + get_rand(8);
+                mesh.add_face({idx, id, (U8)((axis << 1) | get_rand(2))});
+                ref[{idx, axis}] = id;
+            }
+        }
+        ///the same as the clients do with a chunk update
+        for(auto const& slot : mesh.removed_faces) {
+            client.erase(slot);
+        }
+        for(auto const& face : mesh.added_faces) {
+            client.push(face);
+        }
+        mesh.commit_updates();
+
+        if(client.len != mesh.faces.len || client.len != ref.size()) {
+            LUX_FATAL("tick %u: %zu client faces, %zu mesh faces, %zu expected",
+                      tick, (SizeT)client.len, (SizeT)mesh.faces.len,
+                      (SizeT)ref.size());
+        }
+        for(Uns i = 0; i < client.len; ++i) {
+            if(!is_same_face(client[i], mesh.faces[i])) {
+                LUX_FATAL("tick %u: face %u differs", tick, i);
+            }
+            U8 axis = (mesh.faces[i].orientation & 0b110) >> 1;
+            auto it = ref.find({mesh.faces[i].idx, axis});
+            if(it == ref.end() || it->second != mesh.faces[i].id) {
+                LUX_FATAL("tick %u: face %u is not in the reference", tick, i);
+            }
+        }
+    }
+    LUX_LOG("face index: %u ticks ok, %zu faces", TICKS, (SizeT)mesh.faces.len);
+    return 0;
+}
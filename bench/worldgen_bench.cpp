@@ -0,0 +1,196 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <sys/resource.h>
+#include <dirent.h>
+#include <unistd.h>
+//
+#include <lux_shared/common.hpp>
+//
+#include <db.hpp>
+#include <map.hpp>
+#include <physics.hpp>
+#include <chunk_loader.hpp>
+#include <chunk_codec.hpp>
+#include <slab_pool.hpp>
+
+///generates and meshes a fixed region of the map, the checksum depends only
+///on the seed and the region, so it can be compared between builds
+
+typedef std::chrono::steady_clock Clock;
+
+static F64 get_seconds(Clock::time_point const& since) {
+    return std::chrono::duration<F64>(Clock::now() - since).count();
+}
+
+static U64 hash_combine(U64 hash, U64 val) {
+    hash ^= val;
+    hash *= 0x100000001b3ull;
+    return hash;
+}
+
+///the world directory only holds files
+static void remove_world(char const* path) {
+    DIR* dir = opendir(path);
+    if(dir == nullptr) return;
+    while(dirent* entry = readdir(dir)) {
+        if(entry->d_name[0] == '.') continue;
+        char file_path[256];
+        snprintf(file_path, sizeof(file_path), "%s/%s", path, entry->d_name);
+        unlink(file_path);
+    }
+    closedir(dir);
+    if(rmdir(path) != 0) {
+        LUX_LOG_WARN("failed to remove the temporary world %s", path);
+    }
+}
+
+///independent of the order in which the chunks are visited
+static U64 get_region_checksum(Slice<ChkPos> const& region) {
+    U64 sum = 0;
+    for(auto const& pos : region) {
+        Chunk const& chunk = get_chunk(pos);
+        U64 hash = 0xcbf29ce484222325ull;
+        hash = hash_combine(hash, (U64)pos.x);
+        hash = hash_combine(hash, (U64)pos.y);
+        hash = hash_combine(hash, (U64)pos.z);
+        for(Uns i = 0; i < CHK_VOL; ++i) {
+            hash = hash_combine(hash, chunk[i].id);
+        }
+        sum += hash;
+    }
+    return sum;
+}
+
+///encodes and decodes every chunk of the region, the ratio is relative to
+///both the raw blocks and the in-memory size of the chunks
+static void bench_codec(Slice<ChkPos> const& region, bool use_lz) {
+    SizeT raw_size     = 0;
+    SizeT memory_size  = 0;
+    SizeT encoded_size = 0;
+    F64 encode_time = 0.0;
+    F64 decode_time = 0.0;
+    DynArr<U8> bytes;
+    for(auto const& pos : region) {
+        Chunk const& chunk = get_chunk(pos);
+        raw_size += CHK_VOL * sizeof(Block);
+        memory_size += sizeof(Chunk::Data*) + sizeof(Block) +
+            (chunk.data != nullptr ? chunk.data->get_memory() : 0);
+        bytes.clear();
+        auto encode_start = Clock::now();
+        codec_encode(bytes, chunk.data, chunk.fill, use_lz);
+        encode_time += get_seconds(encode_start);
+        encoded_size += bytes.len;
+        Chunk::Data* data;
+        Block fill;
+        auto decode_start = Clock::now();
+        if(!codec_decode(bytes.beg, bytes.len, data, fill)) {
+            LUX_FATAL("failed to decode chunk {%d, %d, %d}",
+                      (int)pos.x, (int)pos.y, (int)pos.z);
+        }
+        decode_time += get_seconds(decode_start);
+        delete data;
+    }
+    F64 constexpr MB = 1024.0 * 1024.0;
+    LUX_LOG("codec%s: %.1fx of raw, %.1fx of memory, "
+            "encode %.1f MB/s, decode %.1f MB/s", use_lz ? " (lz)" : "",
+            (F64)raw_size / (F64)encoded_size,
+            (F64)memory_size / (F64)encoded_size,
+            (F64)raw_size / MB / encode_time,
+            (F64)raw_size / MB / decode_time);
+}
+
+int main(int argc, char** argv) {
+    ChkCoord radius = 4;
+    ChkCoord z_min  = -2;
+    ChkCoord z_max  = 6;
+    random_seed     = 0;
+    if(argc > 3) {
+        LUX_FATAL("usage: %s [RADIUS] [SEED]", argv[0]);
+    }
+    if(argc > 1) radius      = std::atol(argv[1]);
+    if(argc > 2) random_seed = std::strtoull(argv[2], nullptr, 10);
+    if(radius <= 0) {
+        LUX_FATAL("invalid radius %d given", (int)radius);
+    }
+
+    ///a fresh world, so that nothing gets read from the disk
+    char world_path[] = "/tmp/lux-worldgen-bench.XXXXXX";
+    if(mkdtemp(world_path) == nullptr) {
+        LUX_FATAL("failed to create a temporary world directory");
+    }
+    LUX_LOG("world: %s", world_path);
+    ///deferred first, so that it runs after map_deinit
+    LUX_DEFER { remove_world(world_path); };
+
+    db_init();
+    map_init(world_path);
+    LUX_DEFER { map_deinit(); };
+    physics_init();
+
+    ///the meshes need the chunks on their positive sides loaded as well
+    DynArr<ChkPos> region;
+    DynArr<ChkPos> load_region;
+    for(ChkCoord z = z_min; z <= z_max; ++z) {
+        for(ChkCoord y = -radius; y <= radius; ++y) {
+            for(ChkCoord x = -radius; x <= radius; ++x) {
+                load_region.push({x, y, z});
+                if(x < radius && y < radius && z < z_max) {
+                    region.push({x, y, z});
+                }
+            }
+        }
+    }
+    LUX_LOG("seed: %zu", (SizeT)random_seed);
+    LUX_LOG("region: %zu chunks, %zu loaded",
+            (SizeT)region.len, (SizeT)load_region.len);
+
+    auto load_start = Clock::now();
+    loader_enqueue_wait(load_region);
+    ///merges the results and the suspended block changes
+    map_tick();
+    F64 load_time = get_seconds(load_start);
+
+    auto mesh_start = Clock::now();
+    Uns meshes_left;
+    do {
+        meshes_left = 0;
+        for(auto const& pos : region) {
+            if(!try_guarantee_chunk_mesh(pos)) {
+                meshes_left++;
+            }
+        }
+        map_tick();
+    } while(meshes_left > 0);
+    F64 mesh_time = get_seconds(mesh_start);
+
+    SizeT faces_num = 0;
+    for(auto const& pos : region) {
+        Chunk const& chunk = get_chunk(pos);
+        if(chunk.mesh_state != Chunk::NOT_BUILT &&
+           chunk.mesh_state != Chunk::BUILT_EMPTY) {
+            faces_num += chunk.mesh->faces.len;
+        }
+    }
+
+    LoaderStats stats = loader_get_stats();
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+
+    LUX_LOG("generation: %.3fs, %.1f chunks/s",
+            load_time, (F64)load_region.len / load_time);
+    LUX_LOG("    height:    %.3fs", stats.height_time);
+    LUX_LOG("    terrain:   %.3fs", stats.terrain_time);
+    LUX_LOG("    trees:     %.3fs", stats.trees_time);
+    LUX_LOG("    worms:     %.3fs", stats.worms_time);
+    LUX_LOG("    suspended: %.3fs", stats.suspended_time);
+    LUX_LOG("    storage:   %.3fs", stats.storage_time);
+    LUX_LOG("meshing: %.3fs, %.1f chunks/s, %zu faces",
+            mesh_time, (F64)region.len / mesh_time, faces_num);
+    bench_codec(region, false);
+    bench_codec(region, true);
+    slab_log_stats();
+    LUX_LOG("peak memory: %ld KiB", usage.ru_maxrss);
+    LUX_LOG("checksum: %016zx", (SizeT)get_region_checksum(region));
+    return 0;
+}
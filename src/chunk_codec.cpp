@@ -0,0 +1,287 @@
+#include <cstring>
+//
+#include <lux_shared/common.hpp>
+//
+#include <chunk_codec.hpp>
+
+///the encoding starts with the flags and the fill block, chunks with data
+///follow with the palette and the runs, each run is a varint of its length
+///minus one and a palette index, one byte or two if CODEC_WIDE is set;
+///noisy chunks store the indices without the runs if it is shorter
+enum : U8 {
+    CODEC_HAS_DATA = 0b0001,
+    CODEC_WIDE     = 0b0010,
+    CODEC_LZ       = 0b0100,
+    CODEC_RAW      = 0b1000,
+};
+
+///the worst case, every block in its own run with a wide index
+SizeT constexpr MAX_RUNS_LEN  = CHK_VOL * (3 + 2);
+SizeT constexpr LZ_MIN_MATCH  = 4;
+Uns   constexpr LZ_HASH_BITS  = 12;
+SizeT constexpr LZ_MAX_OFFSET = 0xffff;
+
+static void push_bytes(DynArr<U8>& out, void const* bytes, SizeT len) {
+    SizeT off = out.len;
+    out.resize(off + len);
+    std::memcpy(out.beg + off, bytes, len);
+}
+
+static void push_varint(DynArr<U8>& out, U32 val) {
+    while(val >= 0x80) {
+        out.push((U8)(val | 0x80));
+        val >>= 7;
+    }
+    out.push((U8)val);
+}
+
+static bool read_varint(U8 const*& iter, U8 const* end, U32& val) {
+    val = 0;
+    for(Uns shift = 0; shift < 32; shift += 7) {
+        if(iter == end) return false;
+        U8 byte = *iter++;
+        val |= (U32)(byte & 0x7f) << shift;
+        if((byte & 0x80) == 0) return true;
+    }
+    return false;
+}
+
+static U32 read_u32(U8 const* ptr) {
+    U32 val;
+    std::memcpy(&val, ptr, sizeof(U32));
+    return val;
+}
+
+static U32 get_lz_hash(U32 val) {
+    return (val * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+///the lengths which do not fit in the token continue in 255-byte steps
+static void push_lz_len(DynArr<U8>& out, SizeT len) {
+    while(len >= 255) {
+        out.push(255);
+        len -= 255;
+    }
+    out.push((U8)len);
+}
+
+static bool read_lz_len(U8 const*& iter, U8 const* end, SizeT& len) {
+    U8 byte;
+    do {
+        if(iter == end) return false;
+        byte = *iter++;
+        len += byte;
+    } while(byte == 255);
+    return true;
+}
+
+///the token holds the literal length in the high nibble and the match length
+///in the low one, the last sequence has no match
+static void push_lz_sequence(DynArr<U8>& out, U8 const* lits, SizeT lits_len,
+                             SizeT match_len, SizeT offset) {
+    U8 token = (U8)(min(lits_len, (SizeT)15) << 4);
+    if(match_len > 0) {
+        token |= (U8)min(match_len - LZ_MIN_MATCH, (SizeT)15);
+    }
+    out.push(token);
+    if(lits_len >= 15) push_lz_len(out, lits_len - 15);
+    push_bytes(out, lits, lits_len);
+    if(match_len > 0) {
+        out.push((U8)(offset & 0xff));
+        out.push((U8)(offset >> 8));
+        if(match_len - LZ_MIN_MATCH >= 15) {
+            push_lz_len(out, match_len - LZ_MIN_MATCH - 15);
+        }
+    }
+}
+
+static void lz_compress(DynArr<U8>& out, U8 const* in, SizeT len) {
+    static thread_local Arr<U32, 1 << LZ_HASH_BITS> table;
+    std::memset(&table[0], 0xff, sizeof(table));
+    SizeT lits_beg = 0;
+    SizeT i = 0;
+    while(i + LZ_MIN_MATCH <= len) {
+        U32 seq  = read_u32(in + i);
+        U32& slot = table[get_lz_hash(seq)];
+        U32 cand = slot;
+        slot = i;
+        if(cand == ~(U32)0 || i - cand > LZ_MAX_OFFSET ||
+           read_u32(in + cand) != seq) {
+            ++i;
+            continue;
+        }
+        SizeT match_len = LZ_MIN_MATCH;
+        while(i + match_len < len && in[cand + match_len] == in[i + match_len]) {
+            ++match_len;
+        }
+        push_lz_sequence(out, in + lits_beg, i - lits_beg, match_len, i - cand);
+        i += match_len;
+        lits_beg = i;
+    }
+    push_lz_sequence(out, in + lits_beg, len - lits_beg, 0, 0);
+}
+
+static bool lz_decompress(U8* out, SizeT out_len, U8 const* in, SizeT len) {
+    U8 const* end = in + len;
+    SizeT pos = 0;
+    while(true) {
+        if(in == end) return false;
+        U8 token = *in++;
+        SizeT lits_len = token >> 4;
+        if(lits_len == 15 && !read_lz_len(in, end, lits_len)) return false;
+        if((SizeT)(end - in) < lits_len || out_len - pos < lits_len) {
+            return false;
+        }
+        std::memcpy(out + pos, in, lits_len);
+        in  += lits_len;
+        pos += lits_len;
+        if(in == end) return pos == out_len;
+        if(end - in < 2) return false;
+        SizeT offset = (SizeT)in[0] | ((SizeT)in[1] << 8);
+        in += 2;
+        SizeT match_len = token & 0xf;
+        if(match_len == 15 && !read_lz_len(in, end, match_len)) return false;
+        match_len += LZ_MIN_MATCH;
+        if(offset == 0 || offset > pos || out_len - pos < match_len) {
+            return false;
+        }
+        ///the match can overlap with itself, so it is copied byte by byte
+        for(SizeT j = 0; j < match_len; ++j) {
+            out[pos] = out[pos - offset];
+            ++pos;
+        }
+    }
+}
+
+void codec_encode(DynArr<U8>& out, Chunk::Data const* data, Block const& fill,
+                  bool use_lz) {
+    SizeT beg = out.len;
+    U8 flags = data != nullptr ? CODEC_HAS_DATA : 0;
+    out.push(flags);
+    push_bytes(out, &fill, sizeof(Block));
+    if(data == nullptr) return;
+
+    static thread_local Arr<Block, CHK_VOL> blocks;
+    static thread_local Arr<U16, CHK_VOL> idxs;
+    static thread_local DynArr<Block> palette;
+    static thread_local DynArr<U8> runs;
+    data->get_all(&blocks[0]);
+    palette.clear();
+    Uns last = 0;
+    for(Uns i = 0; i < CHK_VOL; ++i) {
+        if(palette.len == 0 || palette[last].id != blocks[i].id) {
+            last = 0;
+            while(last < palette.len && palette[last].id != blocks[i].id) {
+                ++last;
+            }
+            if(last == palette.len) palette.push(blocks[i]);
+        }
+        idxs[i] = last;
+    }
+    if(palette.len > 256) flags |= CODEC_WIDE;
+    SizeT const idx_size = (flags & CODEC_WIDE) ? 2 : 1;
+    runs.clear();
+    for(Uns i = 0; i < CHK_VOL;) {
+        Uns j = i + 1;
+        while(j < CHK_VOL && idxs[j] == idxs[i]) ++j;
+        push_varint(runs, j - i - 1);
+        runs.push((U8)idxs[i]);
+        if(idx_size == 2) runs.push((U8)(idxs[i] >> 8));
+        i = j;
+        if(runs.len >= CHK_VOL * idx_size) break;
+    }
+    if(runs.len >= CHK_VOL * idx_size) {
+        flags |= CODEC_RAW;
+        runs.resize(CHK_VOL * idx_size);
+        for(Uns i = 0; i < CHK_VOL; ++i) {
+            runs[i * idx_size] = (U8)idxs[i];
+            if(idx_size == 2) runs[i * 2 + 1] = (U8)(idxs[i] >> 8);
+        }
+    }
+
+    push_varint(out, palette.len);
+    push_bytes(out, palette.beg, palette.len * sizeof(Block));
+    SizeT body_beg = out.len;
+    if(use_lz) {
+        push_varint(out, runs.len);
+        lz_compress(out, runs.beg, runs.len);
+        if(out.len - body_beg < runs.len) {
+            flags |= CODEC_LZ;
+        } else {
+            out.resize(body_beg);
+        }
+    }
+    if(!(flags & CODEC_LZ)) {
+        push_bytes(out, runs.beg, runs.len);
+    }
+    out[beg] = flags;
+}
+
+bool codec_decode(U8 const* in, SizeT len, Chunk::Data*& data, Block& fill) {
+    data = nullptr;
+    U8 const* end = in + len;
+    if(len < 1 + sizeof(Block)) return false;
+    U8 flags = in[0];
+    std::memcpy(&fill, in + 1, sizeof(Block));
+    in += 1 + sizeof(Block);
+    if(!(flags & CODEC_HAS_DATA)) return in == end;
+
+    static thread_local DynArr<Block> palette;
+    U32 palette_len;
+    if(!read_varint(in, end, palette_len) ||
+       palette_len == 0 || palette_len > CHK_VOL ||
+       (SizeT)(end - in) < palette_len * sizeof(Block)) {
+        return false;
+    }
+    palette.resize(palette_len);
+    std::memcpy(palette.beg, in, palette_len * sizeof(Block));
+    in += palette_len * sizeof(Block);
+
+    U8 const* runs     = in;
+    U8 const* runs_end = end;
+    if(flags & CODEC_LZ) {
+        static thread_local DynArr<U8> buff;
+        U32 runs_len;
+        if(!read_varint(in, end, runs_len) || runs_len > MAX_RUNS_LEN) {
+            return false;
+        }
+        buff.resize(runs_len);
+        if(!lz_decompress(buff.beg, runs_len, in, end - in)) return false;
+        runs     = buff.beg;
+        runs_end = buff.beg + runs_len;
+    }
+
+    static thread_local Arr<Block, CHK_VOL> blocks;
+    SizeT const idx_size = (flags & CODEC_WIDE) ? 2 : 1;
+    if(flags & CODEC_RAW) {
+        if((SizeT)(runs_end - runs) != CHK_VOL * idx_size) return false;
+        for(Uns i = 0; i < CHK_VOL; ++i) {
+            U32 p_idx = runs[i * idx_size];
+            if(idx_size == 2) p_idx |= (U32)runs[i * 2 + 1] << 8;
+            if(p_idx >= palette.len) return false;
+            blocks[i] = palette[p_idx];
+        }
+        data = new Chunk::Data(fill);
+        data->set_all(&blocks[0]);
+        return true;
+    }
+    Uns i = 0;
+    while(runs != runs_end) {
+        U32 run;
+        if(!read_varint(runs, runs_end, run) ||
+           (SizeT)(runs_end - runs) < idx_size) {
+            return false;
+        }
+        U32 p_idx = runs[0];
+        if(idx_size == 2) p_idx |= (U32)runs[1] << 8;
+        runs += idx_size;
+        if(p_idx >= palette.len || run >= CHK_VOL - i) return false;
+        for(U32 j = 0; j <= run; ++j) {
+            blocks[i++] = palette[p_idx];
+        }
+    }
+    if(i != CHK_VOL) return false;
+    data = new Chunk::Data(fill);
+    data->set_all(&blocks[0]);
+    return true;
+}
@@ -0,0 +1,14 @@
+#pragma once
+
+#include <lux_shared/common.hpp>
+//
+#include <map.hpp>
+
+///the blocks are stored as runs of palette indices in the to_chk_idx order,
+///the runs can be compressed further with a byte-oriented LZ pass, which is
+///slower, but helps with the layered terrain repeating itself
+void codec_encode(DynArr<U8>& out, Chunk::Data const* data, Block const& fill,
+                  bool use_lz);
+///returns false if the input is malformed, data is set to nullptr if the
+///chunk consists only of fill, otherwise it is allocated with new
+bool codec_decode(U8 const* in, SizeT len, Chunk::Data*& data, Block& fill);
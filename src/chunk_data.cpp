@@ -0,0 +1,206 @@
+#include <cstring>
+//
+#include <lux_shared/common.hpp>
+//
+#include <slab_pool.hpp>
+#include <map.hpp>
+
+static SlabPool* const data_pool =
+    slab_pool_create("chunk data", sizeof(Chunk::Data));
+///one pool for each of the 1, 2 and 4 bits per block
+static SlabPool* const words_1_pool =
+    slab_pool_create("chunk words 1", (CHK_VOL * 1 / 64) * sizeof(U64));
+static SlabPool* const words_2_pool =
+    slab_pool_create("chunk words 2", (CHK_VOL * 2 / 64) * sizeof(U64));
+static SlabPool* const words_4_pool =
+    slab_pool_create("chunk words 4", (CHK_VOL * 4 / 64) * sizeof(U64));
+static SlabPool* const flat_pool =
+    slab_pool_create("chunk flat", CHK_VOL * sizeof(Block));
+
+static SizeT get_words_len(U8 bits) {
+    return (CHK_VOL * bits) / 64;
+}
+
+static SlabPool* get_words_pool(U8 bits) {
+    switch(bits) {
+        case 1: return words_1_pool;
+        case 2: return words_2_pool;
+        default: LUX_ASSERT(bits == 4); return words_4_pool;
+    }
+}
+
+static U64* alloc_words(U8 bits) {
+    return (U64*)slab_alloc(get_words_pool(bits));
+}
+
+Chunk::Data::Data(Block const& fill) {
+    palette[0]  = fill;
+    palette_len = 1;
+}
+
+Chunk::Data::Data(Data const& that) :
+    palette(that.palette),
+    palette_len(that.palette_len),
+    bits(that.bits),
+    is_flat(that.is_flat) {
+    if(that.words != nullptr) {
+        words = alloc_words(bits);
+        std::memcpy(words, that.words, get_words_len(bits) * sizeof(U64));
+    }
+    if(that.flat != nullptr) {
+        flat = (Block*)slab_alloc(flat_pool);
+        std::memcpy(flat, that.flat, CHK_VOL * sizeof(Block));
+    }
+}
+
+Chunk::Data::~Data() {
+    free_blocks();
+}
+
+void Chunk::Data::release() const {
+    if(refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        delete this;
+    }
+}
+
+void* Chunk::Data::operator new(SizeT size) {
+    LUX_ASSERT(size == sizeof(Data));
+    return slab_alloc(data_pool);
+}
+
+void Chunk::Data::operator delete(void* ptr) {
+    slab_free(data_pool, ptr);
+}
+
+void Chunk::Data::free_blocks() {
+    if(words != nullptr) {
+        slab_free(get_words_pool(bits), words);
+        words = nullptr;
+    }
+    if(flat != nullptr) {
+        slab_free(flat_pool, flat);
+        flat = nullptr;
+    }
+    bits    = 0;
+    is_flat = false;
+}
+
+void Chunk::Data::set_bits(U8 new_bits) {
+    LUX_ASSERT(new_bits > bits && 64 % new_bits == 0);
+    U64* new_words = alloc_words(new_bits);
+    std::memset(new_words, 0, get_words_len(new_bits) * sizeof(U64));
+    if(bits != 0) {
+        for(Uns i = 0; i < CHK_VOL; ++i) {
+            Uns bit = i * bits;
+            U64 val = (words[bit / 64] >> (bit % 64)) & ((1ull << bits) - 1);
+            Uns new_bit = i * new_bits;
+            new_words[new_bit / 64] |= val << (new_bit % 64);
+        }
+        slab_free(get_words_pool(bits), words);
+    }
+    words = new_words;
+    bits  = new_bits;
+}
+
+void Chunk::Data::set_flat() {
+    Block* new_flat = (Block*)slab_alloc(flat_pool);
+    get_all(new_flat);
+    free_blocks();
+    flat        = new_flat;
+    is_flat     = true;
+    palette_len = 0;
+}
+
+void Chunk::Data::set(ChkIdx idx, Block const& block) {
+    if(is_flat) {
+        flat[idx] = block;
+        return;
+    }
+    Uns p_idx = 0;
+    while(p_idx < palette_len && palette[p_idx].id != block.id) ++p_idx;
+    if(p_idx == palette_len) {
+        if(palette_len == MAX_PALETTE_LEN) {
+            set_flat();
+            flat[idx] = block;
+            return;
+        }
+        palette[palette_len++] = block;
+        if(palette_len > (1u << bits)) {
+            set_bits(bits == 0 ? 1 : bits * 2);
+        }
+    }
+    if(bits == 0) return;
+    Uns bit = (Uns)idx * bits;
+    U64& word = words[bit / 64];
+    word &= ~(((1ull << bits) - 1) << (bit % 64));
+    word |= (U64)p_idx << (bit % 64);
+}
+
+void Chunk::Data::get_all(Block* out) const {
+    if(is_flat) {
+        std::memcpy(out, flat, CHK_VOL * sizeof(Block));
+    } else if(bits == 0) {
+        for(Uns i = 0; i < CHK_VOL; ++i) {
+            out[i] = palette[0];
+        }
+    } else {
+        ///a whole word at a time, the entries never cross the words
+        Uns const per_word  = 64 / bits;
+        U64 const mask      = (1ull << bits) - 1;
+        Uns const words_len = get_words_len(bits);
+        for(Uns w = 0; w < words_len; ++w) {
+            U64 word = words[w];
+            for(Uns i = 0; i < per_word; ++i) {
+                *out++ = palette[word & mask];
+                word >>= bits;
+            }
+        }
+    }
+}
+
+void Chunk::Data::set_all(Block const* in) {
+    free_blocks();
+    palette_len = 0;
+    ///indices of the blocks, stored as bytes until the size is known
+    static thread_local Arr<U8, CHK_VOL> idxs;
+    Uns last = 0;
+    for(Uns i = 0; i < CHK_VOL; ++i) {
+        ///most of the neighboring blocks are the same
+        if(palette_len == 0 || palette[last].id != in[i].id) {
+            last = 0;
+            while(last < palette_len && palette[last].id != in[i].id) ++last;
+            if(last == palette_len) {
+                if(palette_len == MAX_PALETTE_LEN) {
+                    flat = (Block*)slab_alloc(flat_pool);
+                    std::memcpy(flat, in, CHK_VOL * sizeof(Block));
+                    is_flat     = true;
+                    palette_len = 0;
+                    return;
+                }
+                palette[palette_len++] = in[i];
+            }
+        }
+        idxs[i] = last;
+    }
+    while((1u << bits) < palette_len) {
+        bits = bits == 0 ? 1 : bits * 2;
+    }
+    if(bits == 0) return;
+    words = alloc_words(bits);
+    Uns const per_word  = 64 / bits;
+    Uns const words_len = get_words_len(bits);
+    for(Uns w = 0; w < words_len; ++w) {
+        U64 word = 0;
+        for(Uns i = 0; i < per_word; ++i) {
+            word |= (U64)idxs[w * per_word + i] << (i * bits);
+        }
+        words[w] = word;
+    }
+}
+
+SizeT Chunk::Data::get_memory() const {
+    SizeT size = sizeof(Data);
+    if(words != nullptr) size += get_words_len(bits) * sizeof(U64);
+    if(flat  != nullptr) size += CHK_VOL * sizeof(Block);
+    return size;
+}
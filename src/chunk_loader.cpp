@@ -1,80 +1,617 @@
 #include <thread>
 #include <mutex>
+#include <algorithm>
 #include <condition_variable>
 #include <atomic>
+#include <chrono>
+#include <iterator>
 //
 #include <lux_shared/noise.hpp>
 //
+#include <chunk_codec.hpp>
+#include <region.hpp>
+#include <chunk_saver.hpp>
 #include <chunk_loader.hpp>
 
-static std::thread thread;
+static List<std::thread> threads;
 
-static VecSet<ChkPos> chunk_queue_set;
-static Queue<ChkPos>  chunk_queue;
+struct LoaderRequest {
+    ChkPos pos;
+    bool   is_urgent;
+    ///squared distance to the nearest focus point
+    U64    dist;
+    ///keeps the requests with equal priority in FIFO order
+    U64    seq;
+};
+
+struct LoaderRequestState {
+    ///number of requesters which still need the chunk
+    Uns  refs       = 0;
+    bool is_urgent  = false;
+    bool is_loading = false;
+};
+
+///a binary heap, use request_cmp for heap operations, the top is at the front
+static DynArr<LoaderRequest> chunk_queue;
+///contains both the queued chunks and the ones that are being loaded right now
+static VecMap<ChkPos, LoaderRequestState> chunk_queue_set;
+static DynArr<ChkPos> focus;
+static U64 request_seq = 0;
 
 static std::mutex queue_mutex;
 static std::mutex results_mutex;
-static std::mutex block_changes_mutex;
+static std::mutex height_map_mutex;
 static std::atomic<bool> is_running;
 static std::condition_variable queue_cv;
+static std::condition_variable done_cv;
+static std::condition_variable height_map_cv;
 
-static LoaderBlockChanges block_changes;
+///the suspended block changes are split between shards by the chunk
+///position, so the workers writing to different chunks rarely contend
+Uns constexpr BLOCK_CHANGES_SHARDS_NUM = 64;
+struct BlockChangesShard {
+    std::mutex         mutex;
+    LoaderBlockChanges changes;
+};
+static Arr<BlockChangesShard, BLOCK_CHANGES_SHARDS_NUM> block_changes;
+
+static BlockChangesShard& get_block_changes_shard(ChkPos const& pos) {
+    U64 hash = (U64)pos.x * 0x9e3779b97f4a7c15ull ^
+               (U64)pos.y * 0xc2b2ae3d27d4eb4full ^
+               (U64)pos.z * 0x165667b19e3779f9ull;
+    return block_changes[(hash >> 32) % BLOCK_CHANGES_SHARDS_NUM];
+}
+
+static void push_block_change(ChkPos const& pos, BlockChange const& change) {
+    auto& shard = get_block_changes_shard(pos);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    shard.changes[pos].push(change);
+}
 static LoaderResults results;
+
+enum LoaderStage : Uns {
+    STAGE_HEIGHT,
+    STAGE_TERRAIN,
+    STAGE_TREES,
+    STAGE_WORMS,
+    STAGE_SUSPENDED,
+    STAGE_STORAGE,
+    STAGES_NUM
+};
+///in nanoseconds
+static Arr<std::atomic<U64>, STAGES_NUM> stage_times;
+static std::atomic<U64> chunks_loaded;
+static std::atomic<U64> chunks_read;
+
+///the recently unloaded chunks, encoded without the LZ pass, which would
+///cost more than it saves on the way back
+struct ColdChunk {
+    DynArr<U8>             bytes;
+    List<ChkPos>::iterator order_it;
+};
+static std::mutex cold_mutex;
+static VecMap<ChkPos, ColdChunk> cold_chunks;
+///the oldest chunk is at the front
+static List<ChkPos> cold_order;
+static SizeT cold_memory = 0;
+static SizeT cold_budget;
+static std::atomic<U64> cold_hits(0);
+
+///needs cold_mutex locked
+static void erase_cold_chunk(ChkPos const& pos) {
+    auto& cold = cold_chunks.at(pos);
+    cold_memory -= cold.bytes.len;
+    cold_order.erase(cold.order_it);
+    cold_chunks.erase(pos);
+}
+
+static bool read_cold_chunk(ChkPos const& pos, Chunk::Data*& data,
+                            Block& fill) {
+    std::lock_guard<std::mutex> lock(cold_mutex);
+    if(cold_chunks.count(pos) == 0) return false;
+    auto const& bytes = cold_chunks.at(pos).bytes;
+    bool ok = codec_decode(bytes.beg, bytes.len, data, fill);
+    if(!ok) {
+        LUX_LOG_ERR("failed to decode cold chunk {%d, %d, %d}",
+                    (int)pos.x, (int)pos.y, (int)pos.z);
+    } else {
+        cold_hits.fetch_add(1, std::memory_order_relaxed);
+    }
+    ///the map owns the chunk now, it stores a new copy when unloading it
+    erase_cold_chunk(pos);
+    return ok;
+}
 //@TODO might want to use the excess values somehow
 //@TODO derivative function
 typedef Arr<F32, (CHK_SIZE + 1) * (CHK_SIZE + 1)> HeightChunk;
-static VecMap<Vec2<ChkCoord>, HeightChunk> height_map;
 
-static HeightChunk const& guarantee_height_chunk(Vec2<ChkCoord> const& pos) {
+///a fixed size cache with clock eviction, the worm carver touches lots of
+///far away columns, so we cannot keep all of them around
+struct HeightCacheSlot {
+    Vec2<ChkCoord> pos;
+    bool           is_used       = false;
+    ///cleared by the clock hand, set on every access
+    bool           is_referenced = false;
+    HeightChunk    data;
+};
+static DynArr<HeightCacheSlot> height_cache;
+static Uns clock_hand = 0;
+///maps the height chunk positions to their slots
+static VecMap<Vec2<ChkCoord>, Uns> height_map;
+///height chunks that some thread is generating right now
+static VecSet<Vec2<ChkCoord>> height_map_pending;
+static std::atomic<U64> height_cache_hits(0);
+static std::atomic<U64> height_cache_misses(0);
+static std::atomic<U64> height_cache_evictions(0);
+
+static void generate_height_chunk(HeightChunk& out, Vec2<ChkCoord> const& pos) {
     constexpr Uns octaves    = 16;
     constexpr F32 base_scale = 0.001f;
     constexpr F32 h_exp      = 3.f;
     constexpr F32 max_h      = 512.f;
+    Vec2F base_seed = (Vec2F)(pos * (ChkCoord)CHK_SIZE) * base_scale;
+    Vec2F seed = base_seed;
+    Uns idx = 0;
+    for(Uns y = 0; y < CHK_SIZE + 1; ++y) {
+        for(Uns x = 0; x < CHK_SIZE + 1; ++x) {
+            out[idx] =
+                pow(u_norm(noise_fbm(seed, octaves)), h_exp) * max_h +
+                lux_randf(seed) * 0.15f;
+            seed.x += base_scale;
+            ++idx;
+        }
+        seed.x  = base_seed.x;
+        seed.y += base_scale;
+    }
+}
+
+///needs height_map_mutex locked
+static HeightCacheSlot& evict_height_slot() {
+    while(height_cache[clock_hand].is_used &&
+          height_cache[clock_hand].is_referenced) {
+        height_cache[clock_hand].is_referenced = false;
+        clock_hand = (clock_hand + 1) % height_cache.len;
+    }
+    auto& slot = height_cache[clock_hand];
+    clock_hand = (clock_hand + 1) % height_cache.len;
+    if(slot.is_used) {
+        height_map.erase(slot.pos);
+        height_cache_evictions++;
+    }
+    return slot;
+}
+
+///calls f with the height chunk while the cache is locked,
+///the reference must not escape f, as the slot can get evicted afterwards
+template<typename F>
+static void with_height_chunk(Vec2<ChkCoord> const& pos, F&& f) {
+    std::unique_lock<std::mutex> lock(height_map_mutex);
+    ///chunks in the same column tend to be loaded at the same time, so instead
+    ///of generating the same height chunk twice we wait for the other thread
+    height_map_cv.wait(lock, [&]{return height_map_pending.count(pos) == 0;});
     if(height_map.count(pos) == 0) {
-        auto& h_chunk = height_map[pos];
-        Vec2F base_seed = (Vec2F)(pos * (ChkCoord)CHK_SIZE) * base_scale;
-        Vec2F seed = base_seed;
-        Uns idx = 0;
-        for(Uns y = 0; y < CHK_SIZE + 1; ++y) {
-            for(Uns x = 0; x < CHK_SIZE + 1; ++x) {
-                h_chunk[idx] =
-                    pow(u_norm(noise_fbm(seed, octaves)), h_exp) * max_h +
-                    lux_randf(seed) * 0.15f;
-                seed.x += base_scale;
-                ++idx;
+        height_cache_misses++;
+        height_map_pending.insert(pos);
+        lock.unlock();
+        HeightChunk h_chunk;
+        generate_height_chunk(h_chunk, pos);
+        lock.lock();
+        auto& slot = evict_height_slot();
+        slot.pos           = pos;
+        slot.is_used       = true;
+        slot.is_referenced = true;
+        slot.data          = h_chunk;
+        height_map[pos] = &slot - height_cache.beg;
+        height_map_pending.erase(pos);
+        height_map_cv.notify_all();
+    } else {
+        height_cache_hits++;
+    }
+    auto& slot = height_cache[height_map.at(pos)];
+    slot.is_referenced = true;
+    f(slot.data);
+}
+
+static void get_height_chunk(HeightChunk& out, Vec2<ChkCoord> const& pos) {
+    with_height_chunk(pos, [&](HeightChunk const& h_chunk) {
+        out = h_chunk;
+    });
+}
+
+static F32 get_height(Vec2<ChkCoord> const& pos, IdxPos const& idx_pos) {
+    F32 h;
+    with_height_chunk(pos, [&](HeightChunk const& h_chunk) {
+        h = h_chunk[idx_pos.x + idx_pos.y * (CHK_SIZE + 1)];
+    });
+    return h;
+}
+
+///the worms are planned for a whole region of chunks at once, since they can
+///go up to WORM_MAX_LEN blocks away from their origin chunk; each chunk then
+///carves only the parts of the worms that cross it
+ChkCoord constexpr WORM_REGION_SIZE  = 16;
+U32      constexpr WORM_MAX_LEN      = 500;
+///the steps of a worm are grouped into segments with a common bounding box
+U32      constexpr WORM_SEGMENT_LEN  = 16;
+Uns      constexpr WORM_REGIONS_MAX  = 128;
+static_assert(WORM_MAX_LEN + 10 <= WORM_REGION_SIZE * CHK_SIZE,
+              "worms must not reach further than the neighboring regions");
+
+struct WormSphere {
+    MapPos   center;
+    F32      rad;
+};
+
+struct WormSegment {
+    MapPos min;
+    MapPos max;
+    U32    beg;
+    U32    len;
+};
+
+struct WormRegion {
+    DynArr<WormSphere>          spheres;
+    DynArr<WormSegment>         segments;
+    ///indices of the segments crossing each of the chunks
+    VecMap<ChkPos, DynArr<U32>> index;
+    U64                         last_use;
+};
+
+static VecMap<ChkPos, WormRegion> worm_regions;
+///regions that some thread is planning right now
+static VecSet<ChkPos> worm_regions_pending;
+static U64 worm_regions_tick = 0;
+static std::mutex worm_regions_mutex;
+static std::condition_variable worm_regions_cv;
+
+static ChkPos to_worm_region_pos(ChkPos const& pos) {
+    ChkPos r_pos;
+    for(Uns a = 0; a < 3; ++a) {
+        r_pos[a] = (pos[a] >= 0 ? pos[a] : pos[a] - (WORM_REGION_SIZE - 1)) /
+            WORM_REGION_SIZE;
+    }
+    return r_pos;
+}
+
+static void add_worm_segment(WormRegion& out, U32 beg) {
+    WormSegment segment = {out.spheres[beg].center, out.spheres[beg].center,
+                           beg, 0};
+    for(U32 i = beg; i < out.spheres.len; ++i) {
+        auto const& sphere = out.spheres[i];
+        MapPos r_rad = MapPos(ceil(sphere.rad));
+        segment.min = min(segment.min, sphere.center - r_rad);
+        segment.max = max(segment.max, sphere.center + r_rad);
+        segment.len++;
+    }
+    U32 idx = out.segments.len;
+    out.segments.push(segment);
+    ChkPos min_pos = to_chk_pos(segment.min);
+    ChkPos max_pos = to_chk_pos(segment.max);
+    for(ChkCoord z = min_pos.z; z <= max_pos.z; ++z) {
+        for(ChkCoord y = min_pos.y; y <= max_pos.y; ++y) {
+            for(ChkCoord x = min_pos.x; x <= max_pos.x; ++x) {
+                out.index[ChkPos(x, y, z)].push(idx);
             }
-            seed.x  = base_seed.x;
-            seed.y += base_scale;
         }
     }
-    auto const& h_chunk = height_map[pos];
-    return h_chunk;
 }
 
-static void load_chunk(ChkPos const& pos) {
-    Chunk::Data* chunk = lux_alloc<Chunk::Data>(1);
-    auto get_block =
-    [&](ChkIdx const& idx) -> Block& {
-        return chunk->blocks[idx];
-    };
-    auto write_suspended_block =
-    [&](MapPos const& map_pos, Block const& block) {
-        ChkPos chk_pos = to_chk_pos(map_pos);
-        ChkIdx idx = to_chk_idx(map_pos);
-        if(chk_pos == pos) {
-            get_block(idx) = block;
-        } else {
-            block_changes_mutex.lock();
-            block_changes[chk_pos].push({idx, block});
-            block_changes_mutex.unlock();
+static void plan_worm(WormRegion& out, ChkPos const& pos, Uns i) {
+    MapPos base_pos = to_map_pos(pos, 0);
+    Vec3F dir;
+    U32 len = lux_randmm(10, WORM_MAX_LEN, pos, i, 0);
+    dir = lux_rand_norm_3(pos, i, 1);
+    Vec3F map_pos = to_map_pos(pos, lux_randm(CHK_VOL, pos, i, 2));
+    F32 rad = lux_randfmm(2, 5, pos, i, 3);
+    U32 segment_beg = out.spheres.len;
+    for(Uns j = 0; j < len; ++j) {
+        rad = noise_fbm(((F32)(j + i) * 1000.f +
+            length((Vec3F)base_pos)) * 0.05f, 3);
+        rad = u_norm(rad) * 9.f + 1.f;
+        rad *= 1.f - abs(s_norm((F32)j / (F32)len));
+        F32 h = get_height(to_chk_pos(map_pos), to_idx_pos(map_pos));
+        if(map_pos.z > h + rad) {
+            ///we have drilled too far into the surface by now
+            break;
         }
-    };
+        out.spheres.push({(MapPos)floor(map_pos), rad});
+        if(out.spheres.len - segment_beg == WORM_SEGMENT_LEN) {
+            add_worm_segment(out, segment_beg);
+            segment_beg = out.spheres.len;
+        }
+        map_pos += dir;
+        Vec3F ch = {lux_randf(pos, i, 5, j, 0) - 0.5f,
+                    lux_randf(pos, i, 5, j, 1) - 0.5f,
+                    lux_randf(pos, i, 5, j, 2) - 0.5f};
+        ch *= 0.4f;
+        dir += ch;
+        dir = normalize(dir);
+    }
+    if(out.spheres.len > segment_beg) {
+        add_worm_segment(out, segment_beg);
+    }
+}
+
+static void plan_worm_region(WormRegion& out, ChkPos const& r_pos) {
+    ChkPos base = r_pos * WORM_REGION_SIZE;
+    ///the worms start only underground
+    ChkCoord max_z = min(base.z + WORM_REGION_SIZE, (ChkCoord)0);
+    for(ChkCoord z = base.z; z < max_z; ++z) {
+        for(ChkCoord y = base.y; y < base.y + WORM_REGION_SIZE; ++y) {
+            for(ChkCoord x = base.x; x < base.x + WORM_REGION_SIZE; ++x) {
+                ChkPos pos(x, y, z);
+                U32 worms_num = lux_randf(pos) > 0.99 ? 1 : 0;
+                for(Uns i = 0; i < worms_num; ++i) {
+                    plan_worm(out, pos, i);
+                }
+            }
+        }
+    }
+}
+
+///needs worm_regions_mutex locked
+static void evict_worm_region() {
+    auto oldest = worm_regions.end();
+    for(auto it = worm_regions.begin(); it != worm_regions.end(); ++it) {
+        if(oldest == worm_regions.end() ||
+           it->second.last_use < oldest->second.last_use) {
+            oldest = it;
+        }
+    }
+    worm_regions.erase(oldest);
+}
+
+///calls f with the worm region while the regions are locked
+template<typename F>
+static void with_worm_region(ChkPos const& r_pos, F&& f) {
+    std::unique_lock<std::mutex> lock(worm_regions_mutex);
+    worm_regions_cv.wait(lock,
+        [&]{return worm_regions_pending.count(r_pos) == 0;});
+    if(worm_regions.count(r_pos) == 0) {
+        worm_regions_pending.insert(r_pos);
+        lock.unlock();
+        WormRegion region;
+        plan_worm_region(region, r_pos);
+        lock.lock();
+        if(worm_regions.size() >= WORM_REGIONS_MAX) {
+            evict_worm_region();
+        }
+        worm_regions[r_pos] = move(region);
+        worm_regions_pending.erase(r_pos);
+        worm_regions_cv.notify_all();
+    }
+    auto& region = worm_regions.at(r_pos);
+    region.last_use = worm_regions_tick++;
+    f((WormRegion const&)region);
+}
+
+///appends the spheres of all the worms which cross the chunk
+static void get_worm_spheres(DynArr<WormSphere>& out, ChkPos const& pos) {
+    MapPos chk_min = to_map_pos(pos, 0);
+    MapPos chk_max = chk_min + MapPos(CHK_SIZE - 1);
+    ChkPos r_pos = to_worm_region_pos(pos);
+    for(ChkCoord z = -1; z <= 1; ++z) {
+        for(ChkCoord y = -1; y <= 1; ++y) {
+            for(ChkCoord x = -1; x <= 1; ++x) {
+                with_worm_region(r_pos + ChkPos(x, y, z),
+                [&](WormRegion const& region) {
+                    if(region.index.count(pos) == 0) return;
+                    for(auto const& idx : region.index.at(pos)) {
+                        auto const& segment = region.segments[idx];
+                        for(U32 i = 0; i < segment.len; ++i) {
+                            auto const& sphere =
+                                region.spheres[segment.beg + i];
+                            MapPos r_rad = MapPos(ceil(sphere.rad));
+                            if(glm::all(glm::lessThanEqual(
+                                   sphere.center - r_rad, chk_max)) &&
+                               glm::all(glm::lessThanEqual(
+                                   chk_min, sphere.center + r_rad))) {
+                                out.push(sphere);
+                            }
+                        }
+                    }
+                });
+            }
+        }
+    }
+}
+
+///the heights of a column and of its +x and +y neighbors
+struct ColumnHeights {
+    F32 h;
+    F32 hx;
+    F32 hy;
+};
+
+static ColumnHeights get_column_heights(Vec2<MapCoord> const& col) {
+    MapPos map_pos(col.x, col.y, 0);
+    IdxPos idx_pos = to_idx_pos(map_pos);
+    ColumnHeights out;
+    with_height_chunk(to_chk_pos(map_pos), [&](HeightChunk const& h_chunk) {
+        Uns idx = idx_pos.x + idx_pos.y * (CHK_SIZE + 1);
+        out.h  = h_chunk[idx];
+        out.hx = h_chunk[idx + 1];
+        out.hy = h_chunk[idx + CHK_SIZE + 1];
+    });
+    return out;
+}
+
+static BlockId get_terrain_block(MapPos const& map_pos,
+                                 ColumnHeights const& heights) {
     static const BlockId raw_stone  = db_block_id("raw_stone"_l);
     static const BlockId dark_grass = db_block_id("dark_grass"_l);
     static const BlockId dirt       = db_block_id("dirt"_l);
     static const BlockId snow       = db_block_id("snow"_l);
+    Vec2<MapCoord> h_pos = (Vec2<MapCoord>)map_pos;
+    F32 h = heights.h;
+    MapCoord f_h = ceil(h);
+    if(map_pos.z > f_h) {
+        return void_block;
+    }
+    F32 diffx = abs(h - heights.hx);
+    F32 diffy = abs(h - heights.hy);
+    F32 diff = (diffx + diffy) / 2.f;
+    if(map_pos.z > f_h - max(diffx, diffy) + 1 && (map_pos.z - 240.f) * 0.005f > noise_fbm((Vec2F)h_pos * 0.09f, 4) - 0.2f) {
+        return snow;
+    }
+    if(map_pos.z >= f_h - 2 - diff * 10.f) {
+        if(diff < 0.7f && lux_randf(h_pos, 1) < pow(noise_fbm((Vec2F)h_pos * 0.08f, 2), 3.f) + 0.97f) {
+            return dark_grass;
+        } else if(diff < 1.f) {
+            return dirt;
+        } else {
+            return raw_stone;
+        }
+    } else if(map_pos.z >= f_h - 4) {
+        return dirt;
+    }
+    return raw_stone;
+}
+
+///the trees are scattered over a jittered grid, at most one per cell, so the
+///trees which can reach a chunk are found without looking at its blocks
+MapCoord constexpr TREE_CELL_SIZE  = 8;
+F32      constexpr TREE_CHANCE     = 0.3f;
+MapCoord constexpr TREE_RADIUS     = 5;
+Uns      constexpr TREE_MIN_HEIGHT = 8;
+Uns      constexpr TREE_MAX_HEIGHT = 20;
+///the trunk starts at the root, the leaves end at 1.5 * height
+MapCoord constexpr TREE_MAX_TOP    = TREE_MAX_HEIGHT + TREE_MAX_HEIGHT / 2;
+
+static MapCoord floor_div(MapCoord a, MapCoord b) {
+    return (a >= 0 ? a : a - (b - 1)) / b;
+}
+
+///calls write for every block of the tree, the trunk comes before the leaves
+template<typename F>
+static void stamp_tree(MapPos const& root, F&& write) {
+    static const BlockId dirt  = db_block_id("dirt"_l);
+    static const BlockId grass = db_block_id("grass"_l);
+    Uns h = lux_randmm(TREE_MIN_HEIGHT, TREE_MAX_HEIGHT, root, 0);
+    for(Uns j = 0; j < h; ++j) {
+        write(root + MapPos(0, 0, j), dirt);
+    }
+    for(MapCoord z = -((Int)h / 2 + 2); z <= (Int)h / 2; ++z) {
+        for(MapCoord y = -TREE_RADIUS; y <= TREE_RADIUS; ++y) {
+            for(MapCoord x = -TREE_RADIUS; x <= TREE_RADIUS; ++x) {
+                if((F32)((h / 2) + 2 - z) / 4.f > length(Vec2F(x, y))) {
+                    write(root + MapPos(x, y, h + z), grass);
+                }
+            }
+        }
+    }
+}
+
+///calls f with the roots of all the trees which can reach the chunk
+template<typename F>
+static void for_each_tree(ChkPos const& pos, F&& f) {
+    static const BlockId dark_grass = db_block_id("dark_grass"_l);
+    MapPos chk_min = to_map_pos(pos, 0);
+    MapPos chk_max = chk_min + MapPos(CHK_SIZE - 1);
+    Vec2<MapCoord> cell_min =
+        {floor_div(chk_min.x - TREE_RADIUS, TREE_CELL_SIZE),
+         floor_div(chk_min.y - TREE_RADIUS, TREE_CELL_SIZE)};
+    Vec2<MapCoord> cell_max =
+        {floor_div(chk_max.x + TREE_RADIUS, TREE_CELL_SIZE),
+         floor_div(chk_max.y + TREE_RADIUS, TREE_CELL_SIZE)};
+    for(MapCoord cy = cell_min.y; cy <= cell_max.y; ++cy) {
+        for(MapCoord cx = cell_min.x; cx <= cell_max.x; ++cx) {
+            Vec2<MapCoord> cell(cx, cy);
+            if(lux_randf(cell, 2) >= TREE_CHANCE) continue;
+            Vec2<MapCoord> col = cell * TREE_CELL_SIZE +
+                Vec2<MapCoord>(lux_randm(TREE_CELL_SIZE, cell, 3),
+                               lux_randm(TREE_CELL_SIZE, cell, 4));
+            if(col.x < chk_min.x - TREE_RADIUS ||
+               col.x > chk_max.x + TREE_RADIUS ||
+               col.y < chk_min.y - TREE_RADIUS ||
+               col.y > chk_max.y + TREE_RADIUS) continue;
+            ColumnHeights heights = get_column_heights(col);
+            MapPos root(col.x, col.y, ceil(heights.h));
+            if(root.z + TREE_MAX_TOP < chk_min.z || root.z > chk_max.z) continue;
+            ///trees grow only on dark grass
+            if(get_terrain_block(root, heights) != dark_grass) continue;
+            f(root);
+        }
+    }
+}
+
+///checks the conditions of the terrain pass once per column instead of once
+///per block, returns true if the whole chunk is void or raw stone, in which
+///case out is set to that block; snowy columns are never considered uniform
+static bool get_uniform_terrain(Block& out, ChkPos const& pos,
+                                HeightChunk const& h_chunk) {
+    static const BlockId raw_stone = db_block_id("raw_stone"_l);
+    MapCoord const z0 = pos.z * (MapCoord)CHK_SIZE;
+    MapCoord const z1 = z0 + (MapCoord)CHK_SIZE - 1;
+    bool is_void  = true;
+    bool is_stone = true;
+    auto get_h = [&](Uns x, Uns y) {
+        return h_chunk[x + y * (CHK_SIZE + 1)];
+    };
+    for(Uns y = 0; y < CHK_SIZE; ++y) {
+        for(Uns x = 0; x < CHK_SIZE; ++x) {
+            F32 h = get_h(x, y);
+            MapCoord f_h = ceil(h);
+            is_void &= z0 > f_h;
+            if(is_stone) {
+                F32 diffx = abs(h - get_h(x + 1, y));
+                F32 diffy = abs(h - get_h(x, y + 1));
+                F32 diff = (diffx + diffy) / 2.f;
+                ///all of the conditions are monotonic in z,
+                ///so it is enough to check the top of the chunk
+                is_stone = z1 <= f_h && !(z1 > f_h - max(diffx, diffy) + 1) &&
+                    (diff >= 1.f || (!(z1 >= f_h - 2 - diff * 10.f) &&
+                                     !(z1 >= f_h - 4)));
+            }
+            if(!is_void && !is_stone) return false;
+        }
+    }
+    out.id = is_void ? void_block : raw_stone;
+    return true;
+}
+
+///materializes the blocks of a uniform chunk if needed
+static void set_chunk_block(Chunk::Data*& data, Block const& fill,
+                            ChkIdx idx, Block const& block) {
+    if(data == nullptr) {
+        if(block.id == fill.id) return;
+        data = new Chunk::Data(fill);
+    }
+    data->set(idx, block);
+}
+
+struct StageTimer {
+    std::chrono::steady_clock::time_point start =
+        std::chrono::steady_clock::now();
+
+    void end(LoaderStage stage) {
+        auto now = std::chrono::steady_clock::now();
+        stage_times[stage].fetch_add(std::chrono::duration_cast<
+            std::chrono::nanoseconds>(now - start).count(),
+            std::memory_order_relaxed);
+        start = now;
+    }
+};
+
+///chunk stays nullptr as long as the chunk consists only of fill
+static void generate_chunk(ChkPos const& pos, Chunk::Data*& chunk, Block& fill,
+                           StageTimer& timer) {
+    ///the non-uniform chunks are generated into a flat array first and packed
+    ///once at the end, writing to the packed blocks one by one is slower
+    static thread_local Arr<Block, CHK_VOL> blocks;
+    bool is_uniform = false;
+    auto set_block =
+    [&](ChkIdx const& idx, Block const& block) {
+        if(is_uniform) {
+            set_chunk_block(chunk, fill, idx, block);
+        } else {
+            blocks[idx] = block;
+        }
+    };
     Vec2<ChkCoord> h_pos = pos;
-    auto const& h_chunk = guarantee_height_chunk(h_pos);
+    HeightChunk h_chunk;
+    get_height_chunk(h_chunk, h_pos);
+    timer.end(STAGE_HEIGHT);
 #if 0
     for(Uns i = 0; i < CHK_VOL; ++i) {
         MapPos map_pos = to_map_pos(pos, i);
@@ -87,203 +624,314 @@ static void load_chunk(ChkPos const& pos) {
         }
     }
 #endif
+    ///most of the chunks are either high in the sky or deep underground
+    is_uniform = get_uniform_terrain(fill, pos, h_chunk);
 #if 1
-    for(Uns i = 0; i < CHK_VOL; ++i) {
+    for(Uns i = 0; i < CHK_VOL && !is_uniform; ++i) {
         MapPos map_pos = to_map_pos(pos, i);
-        Vec2<MapCoord> h_pos = (Vec2<MapCoord>)map_pos;
         IdxPos idx_pos = to_idx_pos(i);
         auto get_h = [&](IdxPos p) {
             return h_chunk[p.x + p.y * (CHK_SIZE + 1)];
         };
-        F32 h = get_h(idx_pos);
-        MapCoord f_h = ceil(h);
-
-        Block block;
-        if(map_pos.z > f_h) {
-            block.id = void_block;
-        } else {
-            F32 diffx = abs(h - get_h(idx_pos + IdxPos(1, 0, 0)));
-            F32 diffy = abs(h - get_h(idx_pos + IdxPos(0, 1, 0)));
-            F32 diff = (diffx + diffy) / 2.f;
-            if(map_pos.z > f_h - max(diffx, diffy) + 1 && (map_pos.z - 240.f) * 0.005f > noise_fbm((Vec2F)h_pos * 0.09f, 4) - 0.2f) {
-                    block.id = snow;
-            } else
-            if(map_pos.z >= f_h - 2 - diff * 10.f) {
-                if(diff < 0.7f && lux_randf(h_pos, 1) < pow(noise_fbm((Vec2F)h_pos * 0.08f, 2), 3.f) + 0.97f) {
-                    block.id = dark_grass;
-                } else if(diff < 1.f) {
-                    block.id = dirt;
-                } else {
-                    block.id = raw_stone;
-                }
-            } else if(map_pos.z >= f_h - 4) {
-                block.id = dirt;
-            } else {
-                block.id = raw_stone;
-            }
-        }
-        get_block(i) = block;
-    }
-#endif
-    static const BlockId grass = db_block_id("grass"_l);
-#if 0
-    for(Uns i = 0; i < CHK_VOL; ++i) {
-        MapPos map_pos = to_map_pos(pos, i);
-        if(lux_randf(map_pos, 0) > 0.9999f) {
-            Vec3F dir = lux_rand_norm_3(map_pos, 1);
-            Vec3F iter = (Vec3F)map_pos;
-            for(Uns j = 0; j < 10 * 3; ++j) {
-                write_suspended_block((MapPos)floor(iter), {grass});
-                iter[j % 3] += dir[j % 3];
-            }
-        }
+        blocks[i].id = get_terrain_block(map_pos,
+            {get_h(idx_pos), get_h(idx_pos + IdxPos(1, 0, 0)),
+             get_h(idx_pos + IdxPos(0, 1, 0))});
     }
 #endif
+    timer.end(STAGE_TERRAIN);
 #if 1
-    for(Uns i = 0; i < CHK_VOL; ++i) {
-        MapCoord h = round(h_chunk[i & ((CHK_SIZE * CHK_SIZE) - 1)]);
-        F32 f_h = ceil(h);
-        MapPos map_pos = to_map_pos(pos, i);
-        if(map_pos.z == f_h && lux_randf(map_pos) > .995f &&
-            get_block(i).id == dark_grass) {
-            Uns h = lux_randmm(8, 20, map_pos, 0);
-            for(Uns j = 0; j < h; ++j) {
-                write_suspended_block(map_pos + MapPos(0, 0, j), {dirt});
-            }
-            for(MapCoord z = -((Int)h / 2 + 2); z <= (Int)h / 2; ++z) {
-                for(MapCoord y = -5; y <= 5; ++y) {
-                    for(MapCoord x = -5; x <= 5; ++x) {
-                        if((F32)((h / 2) + 2 - z) / 4.f > length(Vec2F(x, y))) {
-                            write_suspended_block(map_pos + MapPos(x, y, h + z),
-                                                  {grass});
-                        }
-                    }
+    ///every chunk stamps the parts of the trees which reach into it, so the
+    ///leaves do not have to be handed over to the neighboring chunks
+    {   MapPos chk_min = to_map_pos(pos, 0);
+        MapPos chk_max = chk_min + MapPos(CHK_SIZE - 1);
+        for_each_tree(pos, [&](MapPos const& root) {
+            stamp_tree(root, [&](MapPos const& map_pos, BlockId id) {
+                if(glm::all(glm::lessThanEqual(chk_min, map_pos)) &&
+                   glm::all(glm::lessThanEqual(map_pos, chk_max))) {
+                    set_block(to_chk_idx(map_pos), {id});
                 }
-            }
-        }
+            });
+        });
     }
 #endif
+    timer.end(STAGE_TREES);
 #if 1
-    MapPos base_pos = to_map_pos(pos, 0);
-    if(pos.z < 0) {
-        U32 worms_num = lux_randf(pos) > 0.99 ? 1 : 0;
-        for(Uns i = 0; i < worms_num; ++i) {
-            Vec3F dir;
-            U32 len = lux_randmm(10, 500, pos, i, 0);
-            dir = lux_rand_norm_3(pos, i, 1);
-            Vec3F map_pos = to_map_pos(pos, lux_randm(CHK_VOL, pos, i, 2));
-            F32 rad = lux_randfmm(2, 5, pos, i, 3);
-            for(Uns j = 0; j < len; ++j) {
-                rad = noise_fbm(((F32)(j + i) * 1000.f +
-                    length((Vec3F)base_pos)) * 0.05f, 3);
-                rad = u_norm(rad) * 9.f + 1.f;
-                rad *= 1.f - abs(s_norm((F32)j / (F32)len));
-                Vec2<ChkCoord> h_pos = to_chk_pos(map_pos);
-                HeightChunk const& h_chk = guarantee_height_chunk(h_pos);
-                IdxPos idx_pos = to_idx_pos(map_pos);
-                F32 h = h_chk[idx_pos.x + idx_pos.y * (CHK_SIZE + 1)];
-                if(map_pos.z > h + rad) {
-                    ///we have drilled too far into the surface by now
-                    break;
-                }
-                MapCoord r_rad = ceil(rad);
-                for(MapCoord z = -r_rad; z <= r_rad; ++z) {
-                    for(MapCoord y = -r_rad; y <= r_rad; ++y) {
-                        for(MapCoord x = -r_rad; x <= r_rad; ++x) {
-                            if(length(Vec3F(x, y, z)) < rad) {
-                                write_suspended_block(floor(map_pos + Vec3F(x, y, z)),
-                                    {void_block});
-                            }
+    {   static thread_local DynArr<WormSphere> spheres;
+        spheres.clear();
+        get_worm_spheres(spheres, pos);
+        MapPos chk_min = to_map_pos(pos, 0);
+        MapPos chk_max = chk_min + MapPos(CHK_SIZE - 1);
+        for(auto const& sphere : spheres) {
+            MapPos r_rad = MapPos(ceil(sphere.rad));
+            MapPos min_pos = max(sphere.center - r_rad, chk_min);
+            MapPos max_pos = min(sphere.center + r_rad, chk_max);
+            for(MapCoord z = min_pos.z; z <= max_pos.z; ++z) {
+                for(MapCoord y = min_pos.y; y <= max_pos.y; ++y) {
+                    for(MapCoord x = min_pos.x; x <= max_pos.x; ++x) {
+                        MapPos map_pos(x, y, z);
+                        if(length((Vec3F)(map_pos - sphere.center)) <
+                               sphere.rad) {
+                            set_block(to_chk_idx(map_pos), {void_block});
                         }
                     }
                 }
-                map_pos += dir;
-                Vec3F ch = {lux_randf(pos, i, 5, j, 0) - 0.5f,
-                            lux_randf(pos, i, 5, j, 1) - 0.5f,
-                            lux_randf(pos, i, 5, j, 2) - 0.5f};
-                ch *= 0.4f;
-                dir += ch;
-                dir = normalize(dir);
             }
         }
     }
 #endif
-    block_changes_mutex.lock();
-    if(block_changes.count(pos) > 0) {
-        auto const& changes = block_changes.at(pos);
+    if(!is_uniform) {
+        chunk = new Chunk::Data(fill);
+        chunk->set_all(&blocks[0]);
+        if(chunk->bits == 0 && !chunk->is_flat) {
+            ///the trees or the worms filled the whole chunk
+            fill = chunk->palette[0];
+            delete chunk;
+            chunk = nullptr;
+        }
+    }
+    timer.end(STAGE_WORMS);
+}
+
+static void load_chunk(ChkPos const& pos) {
+    StageTimer timer;
+    Chunk::Data* chunk = nullptr;
+    Block fill = {void_block};
+    ///the saver might not have written the newest version yet
+    bool is_stored = saver_read_chunk(pos, chunk, fill) ||
+                     read_cold_chunk(pos, chunk, fill) ||
+                     region_read_chunk(pos, chunk, fill);
+    timer.end(STAGE_STORAGE);
+    if(is_stored) {
+        chunks_read.fetch_add(1, std::memory_order_relaxed);
+    } else {
+        generate_chunk(pos, chunk, fill, timer);
+        region_write_chunk(pos, chunk, fill);
+        timer.end(STAGE_STORAGE);
+    }
+    ///changes made to the chunk before it was loaded are applied on top of
+    ///the stored version, the map saves them along with the other edits
+    bool is_modified = false;
+    {   DynArr<BlockChange> changes;
+        auto& shard = get_block_changes_shard(pos);
+        shard.mutex.lock();
+        if(shard.changes.count(pos) > 0) {
+            changes = move(shard.changes.at(pos));
+            shard.changes.erase(pos);
+        }
+        shard.mutex.unlock();
         for(auto const& change : changes) {
-            get_block(change.idx) = change.block;
+            set_chunk_block(chunk, fill, change.idx, change.block);
         }
-        block_changes.erase(pos);
+        is_modified = changes.len > 0;
     }
-    block_changes_mutex.unlock();
+    timer.end(STAGE_SUSPENDED);
+    chunks_loaded.fetch_add(1, std::memory_order_relaxed);
     results_mutex.lock();
-    results[pos] = chunk;
+    results[pos] = {chunk, fill, is_modified};
     results_mutex.unlock();
 }
 
+///returns true if a should be loaded after b
+static bool request_cmp(LoaderRequest const& a, LoaderRequest const& b) {
+    if(a.is_urgent != b.is_urgent) return b.is_urgent;
+    if(a.dist      != b.dist)      return a.dist > b.dist;
+    return a.seq > b.seq;
+}
+
+static U64 get_focus_dist(ChkPos const& pos) {
+    if(focus.len == 0) return 0;
+    U64 min_dist = ~(U64)0;
+    for(auto const& f_pos : focus) {
+        ChkPos diff = pos - f_pos;
+        U64 dist = diff.x * diff.x + diff.y * diff.y + diff.z * diff.z;
+        min_dist = min(min_dist, dist);
+    }
+    return min_dist;
+}
+
+///needs queue_mutex locked
+static void push_request(ChkPos const& pos, bool is_urgent) {
+    chunk_queue.push({pos, is_urgent, get_focus_dist(pos), request_seq++});
+    std::push_heap(chunk_queue.beg, chunk_queue.beg + chunk_queue.len,
+                   request_cmp);
+}
+
 static void thread_main() {
     while(true) {
         std::unique_lock<std::mutex> lock(queue_mutex);
-        queue_cv.wait(lock, []{return !chunk_queue.empty() || !is_running.load();});
+        queue_cv.wait(lock, []{return chunk_queue.len > 0 || !is_running.load();});
         if(!is_running.load()) {
             break;
         }
-        ChkPos pos = chunk_queue.front();
+        std::pop_heap(chunk_queue.beg, chunk_queue.beg + chunk_queue.len,
+                      request_cmp);
+        ChkPos pos = chunk_queue.last().pos;
+        chunk_queue.erase(chunk_queue.len - 1);
+        ///a request which got upgraded to urgent or cancelled leaves its old
+        ///copy behind
+        if(chunk_queue_set.count(pos) == 0 ||
+           chunk_queue_set.at(pos).is_loading) {
+            continue;
+        }
+        chunk_queue_set.at(pos).is_loading = true;
         lock.unlock();
         load_chunk(pos);
         lock.lock();
-        chunk_queue.pop();
+        ///the chunk is erased only after it gets into results, so that
+        ///loader_enqueue_wait can check the set for completion
         chunk_queue_set.erase(pos);
         lock.unlock();
-        queue_cv.notify_one();
+        done_cv.notify_all();
     }
 }
 
-void loader_init() {
+void loader_init(Uns threads_num, SizeT height_cache_size,
+                 SizeT cold_cache_size) {
+    if(threads_num == 0) {
+        ///leave one core for the main thread
+        Uns hw_threads = std::thread::hardware_concurrency();
+        threads_num = hw_threads > 1 ? hw_threads - 1 : 1;
+    }
+    {   Uns slots_num = max((SizeT)1, height_cache_size / sizeof(HeightCacheSlot));
+        LUX_LOG("height cache: %zu slots", slots_num);
+        height_cache.resize(slots_num);
+    }
+    cold_budget = cold_cache_size;
+    LUX_LOG("starting %zu chunk loader threads", threads_num);
     is_running.store(true);
-    thread = std::thread(&thread_main);
+    for(Uns i = 0; i < threads_num; ++i) {
+        threads.emplace_back(&thread_main);
+    }
 }
 
 void loader_deinit() {
     is_running.store(false);
     queue_cv.notify_all();
-    thread.join();
+    for(auto& thread : threads) {
+        thread.join();
+    }
+    threads.clear();
+    LoaderStats stats = loader_get_stats();
+    LUX_LOG("height cache stats");
+    LUX_LOG("    hits: %zu", stats.height_cache_hits);
+    LUX_LOG("    misses: %zu", stats.height_cache_misses);
+    LUX_LOG("    evictions: %zu", stats.height_cache_evictions);
+    LUX_LOG("cold chunk cache stats");
+    LUX_LOG("    hits: %zu", stats.cold_hits);
+    LUX_LOG("    chunks: %zu, %zuKB", stats.cold_len, stats.cold_memory / 1024);
+    cold_chunks.clear();
+    cold_order.clear();
+    cold_memory = 0;
 }
 
-void loader_enqueue(Slice<ChkPos> const& chunks) {
+LoaderStats loader_get_stats() {
+    LoaderStats stats;
+    stats.height_cache_hits      = height_cache_hits.load();
+    stats.height_cache_misses    = height_cache_misses.load();
+    stats.height_cache_evictions = height_cache_evictions.load();
+    {   std::lock_guard<std::mutex> lock(height_map_mutex);
+        stats.height_cache_len = height_map.size();
+    }
+    stats.chunks_loaded = chunks_loaded.load();
+    stats.chunks_read   = chunks_read.load();
+    stats.cold_hits     = cold_hits.load();
+    {   std::lock_guard<std::mutex> lock(cold_mutex);
+        stats.cold_len    = cold_chunks.size();
+        stats.cold_memory = cold_memory;
+    }
+    auto get_time = [&](LoaderStage stage) {
+        return (F64)stage_times[stage].load() / 1e9;
+    };
+    stats.height_time    = get_time(STAGE_HEIGHT);
+    stats.terrain_time   = get_time(STAGE_TERRAIN);
+    stats.trees_time     = get_time(STAGE_TREES);
+    stats.worms_time     = get_time(STAGE_WORMS);
+    stats.suspended_time = get_time(STAGE_SUSPENDED);
+    stats.storage_time   = get_time(STAGE_STORAGE);
+    return stats;
+}
+
+void loader_set_focus(Slice<ChkPos> const& new_focus) {
+    std::lock_guard<std::mutex> lock(queue_mutex);
+    if(new_focus.len == focus.len &&
+       std::equal(new_focus.beg, new_focus.beg + new_focus.len, focus.beg)) {
+        return;
+    }
+    focus.resize(new_focus.len);
+    for(Uns i = 0; i < new_focus.len; ++i) {
+        focus[i] = new_focus[i];
+    }
+    ///we rebuild the heap anyway, so it is a good moment to drop stale requests
+    Uns len = 0;
+    for(auto const& request : chunk_queue) {
+        if(chunk_queue_set.count(request.pos) > 0) {
+            auto const& state = chunk_queue_set.at(request.pos);
+            if(!state.is_loading && state.is_urgent == request.is_urgent) {
+                chunk_queue[len] = request;
+                chunk_queue[len].dist = get_focus_dist(request.pos);
+                ++len;
+            }
+        }
+    }
+    chunk_queue.resize(len);
+    std::make_heap(chunk_queue.beg, chunk_queue.beg + chunk_queue.len,
+                   request_cmp);
+}
+
+static void enqueue(Slice<ChkPos> const& chunks, bool is_urgent) {
     queue_mutex.lock();
     results_mutex.lock();
     for(auto const& pos : chunks) {
-        if(results.count(pos) == 0 &&
-           chunk_queue_set.count(pos) == 0) {
-            chunk_queue.push(pos);
-            chunk_queue_set.insert(pos);
+        if(results.count(pos) > 0) continue;
+        if(chunk_queue_set.count(pos) == 0) {
+            auto& state = chunk_queue_set[pos];
+            state.refs      = 1;
+            state.is_urgent = is_urgent;
+            push_request(pos, is_urgent);
+        } else {
+            auto& state = chunk_queue_set.at(pos);
+            state.refs++;
+            if(is_urgent && !state.is_urgent && !state.is_loading) {
+                ///the old request will get skipped by the workers
+                state.is_urgent = true;
+                push_request(pos, true);
+            }
         }
     }
     results_mutex.unlock();
     queue_mutex.unlock();
-    queue_cv.notify_one();
+    queue_cv.notify_all();
 }
 
-void loader_enqueue_wait(Slice<ChkPos> const& chunks) {
-    queue_mutex.lock();
-    results_mutex.lock();
+void loader_enqueue(Slice<ChkPos> const& chunks) {
+    enqueue(chunks, false);
+}
+
+void loader_cancel(Slice<ChkPos> const& chunks) {
+    std::lock_guard<std::mutex> lock(queue_mutex);
     for(auto const& pos : chunks) {
-        if(results.count(pos) == 0 &&
-           chunk_queue_set.count(pos) == 0) {
-            chunk_queue.push(pos);
-            chunk_queue_set.insert(pos);
+        if(chunk_queue_set.count(pos) == 0) continue;
+        auto& state = chunk_queue_set.at(pos);
+        LUX_ASSERT(state.refs > 0);
+        state.refs--;
+        ///chunks that are being loaded right now will end up in the results
+        ///anyway, their heap entries get skipped by the workers
+        if(state.refs == 0 && !state.is_loading) {
+            chunk_queue_set.erase(pos);
         }
     }
-    results_mutex.unlock();
-    queue_mutex.unlock();
-    queue_cv.notify_one();
+}
+
+void loader_enqueue_wait(Slice<ChkPos> const& chunks) {
+    enqueue(chunks, true);
     std::unique_lock<std::mutex> lock(queue_mutex);
-    //@XXX this woke up before the queue was empty in the past, as we unlocked
-    //the queue_mutex in thread_main before loading the chunk,
-    //however right now it seems to work
-    queue_cv.wait(lock, []{return chunk_queue.empty();});
+    ///we only wait for our own chunks, the other workers might still be busy
+    done_cv.wait(lock, [&]{
+        for(auto const& pos : chunks) {
+            if(chunk_queue_set.count(pos) > 0) return false;
+        }
+        return true;
+    });
 }
 
 LoaderResults const& loader_lock_results() {
@@ -305,22 +953,28 @@ void loader_unlock_results() {
     results_mutex.unlock();
 }
 
-bool loader_try_lock_block_changes(LoaderBlockChanges*& out) {
-    if(block_changes_mutex.try_lock()) {
-        out = &block_changes;
-        return true;
-    } else {
-        return false;
+void loader_take_block_changes(LoaderBlockChanges& out,
+                               bool (*is_loaded)(ChkPos const& pos)) {
+    for(auto& shard : block_changes) {
+        ///the shard will be drained on the next call
+        if(!shard.mutex.try_lock()) continue;
+        auto& changes = shard.changes;
+        for(auto it = changes.begin(), end = changes.end(); it != end;) {
+            if(is_loaded(it->first)) {
+                out[it->first] = move(it->second);
+                it = changes.erase(it);
+            } else ++it;
+        }
+        shard.mutex.unlock();
     }
 }
 
-LoaderBlockChanges& loader_lock_block_changes() {
-    block_changes_mutex.lock();
-    return block_changes;
-}
-
-void loader_unlock_block_changes() {
-    block_changes_mutex.unlock();
+bool loader_has_block_changes() {
+    for(auto& shard : block_changes) {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        if(shard.changes.size() > 0) return true;
+    }
+    return false;
 }
 
 void loader_write_suspended_block(Block const& block, MapPos const& pos) {
@@ -328,11 +982,31 @@ void loader_write_suspended_block(Block const& block, MapPos const& pos) {
     ChkIdx chk_idx = to_chk_idx(pos);
     results_mutex.lock();
     if(results.count(chk_pos) > 0) {
-        results.at(chk_pos)->blocks[chk_idx] = block;
+        auto& result = results.at(chk_pos);
+        set_chunk_block(result.data, result.fill, chk_idx, block);
+        result.is_modified = true;
     } else {
-        block_changes_mutex.lock();
-        block_changes[chk_pos].push({chk_idx, block});
-        block_changes_mutex.unlock();
+        push_block_change(chk_pos, {chk_idx, block});
     }
     results_mutex.unlock();
 }
+
+void loader_store_cold(ChkPos const& pos, Chunk::Data const* data,
+                       Block const& fill) {
+    ///encoded outside of the lock, the workers might be waiting for it
+    DynArr<U8> bytes;
+    codec_encode(bytes, data, fill, false);
+    bytes.shrink_to_fit();
+    std::lock_guard<std::mutex> lock(cold_mutex);
+    if(cold_chunks.count(pos) > 0) {
+        erase_cold_chunk(pos);
+    }
+    cold_memory += bytes.len;
+    cold_order.emplace_back(pos);
+    auto& cold = cold_chunks[pos];
+    cold.bytes    = move(bytes);
+    cold.order_it = std::prev(cold_order.end());
+    while(cold_memory > cold_budget && cold_order.size() > 0) {
+        erase_cold_chunk(*cold_order.begin());
+    }
+}
@@ -4,24 +4,71 @@
 //
 #include <map.hpp>
 
-void loader_init();
+struct LoaderStats {
+    U64   height_cache_hits;
+    U64   height_cache_misses;
+    U64   height_cache_evictions;
+    SizeT height_cache_len;
+    U64   chunks_loaded;
+    ///the chunks which were read from the disk instead of being generated
+    U64   chunks_read;
+    ///the chunks which were decoded from the cold chunk cache
+    U64   cold_hits;
+    SizeT cold_len;
+    SizeT cold_memory;
+    ///time spent in each of the generation stages, summed over all the
+    ///workers, in seconds
+    F64   height_time;
+    F64   terrain_time;
+    F64   trees_time;
+    F64   worms_time;
+    F64   suspended_time;
+    F64   storage_time;
+};
+
+///height_cache_size is the memory budget of the height chunk cache in bytes,
+///cold_cache_size is the one of the compressed unloaded chunks
+void loader_init(Uns threads_num, SizeT height_cache_size,
+                 SizeT cold_cache_size);
 void loader_deinit();
+LoaderStats loader_get_stats();
 
+///chunks closer to the focus points get loaded first
+void loader_set_focus(Slice<ChkPos> const& focus);
+///every enqueued chunk holds a reference, which can be dropped with
+///loader_cancel, chunks with no references left are not loaded
 void loader_enqueue(Slice<ChkPos> const& chunks);
+void loader_cancel(Slice<ChkPos> const& chunks);
+///the chunks are loaded ahead of the ones queued by loader_enqueue
 void loader_enqueue_wait(Slice<ChkPos> const& chunks);
 void loader_write_suspended_block(Block const& block, MapPos const& pos);
+///keeps a compressed copy of an unloaded chunk, so that loading it again
+///does not need the disk, the oldest copies get dropped over the budget
+void loader_store_cold(ChkPos const& pos, Chunk::Data const* data,
+                       Block const& fill);
 
 struct BlockChange {
     ChkIdx  idx;
     Block block;
 };
 
-typedef VecMap<ChkPos, Chunk::Data*>        LoaderResults;
+struct LoaderResult {
+    ///nullptr if the chunk consists only of fill
+    Chunk::Data* data;
+    Block        fill;
+    ///the suspended changes were applied, so it differs from the stored one
+    bool         is_modified;
+};
+
+typedef VecMap<ChkPos, LoaderResult>        LoaderResults;
 typedef VecMap<ChkPos, DynArr<BlockChange>> LoaderBlockChanges;
 
-bool loader_try_lock_block_changes(LoaderBlockChanges*& out);
+///moves the suspended changes of the chunks for which is_loaded is true into
+///out, never blocks, shards used by other threads are skipped until next time
+void loader_take_block_changes(LoaderBlockChanges& out,
+                               bool (*is_loaded)(ChkPos const& pos));
+///returns true if some suspended changes wait for their chunks to be loaded
+bool loader_has_block_changes();
 bool loader_try_lock_results(LoaderResults*& out);
-LoaderBlockChanges& loader_lock_block_changes();
-void loader_unlock_block_changes();
 LoaderResults const& loader_lock_results();
 void loader_unlock_results();
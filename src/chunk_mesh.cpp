@@ -0,0 +1,129 @@
+#include <lux_shared/common.hpp>
+//
+#include <map.hpp>
+
+///the entries pack the key + 1 in the upper half and the slot in the lower
+///one, 0 is an empty entry
+static U32 get_face_key(ChkIdx idx, U8 axis) {
+    return (U32)idx * 3 + axis;
+}
+
+static U32 get_face_key(BlockFace const& face) {
+    return get_face_key(face.idx, (face.orientation & 0b110) >> 1);
+}
+
+static U32 get_entry_key(U64 entry) {
+    return (U32)(entry >> 32) - 1;
+}
+
+static Uns get_face_home(U32 key, SizeT cap) {
+    return (key * 0x9e3779b1u) & (cap - 1);
+}
+
+void ChunkMesh::build_face_index() {
+    SizeT len = faces.len + added_faces.len;
+    SizeT cap = 64;
+    while(cap < (len + 1) * 2) cap *= 2;
+    face_slots.resize(cap);
+    for(auto& entry : face_slots) {
+        entry = 0;
+    }
+    for(Uns i = 0; i < faces.len; ++i) {
+        set_face_slot(get_face_key(faces[i]), i);
+    }
+    for(Uns i = 0; i < added_faces.len; ++i) {
+        set_face_slot(get_face_key(added_faces[i]), i | PENDING_SLOT);
+    }
+    ///the slots are the current positions now
+    removed_slots.clear();
+}
+
+Uns ChunkMesh::find_face_entry(U32 key) const {
+    SizeT const mask = face_slots.len - 1;
+    Uns pos = get_face_home(key, face_slots.len);
+    while(face_slots[pos] != 0 && get_entry_key(face_slots[pos]) != key) {
+        pos = (pos + 1) & mask;
+    }
+    return pos;
+}
+
+void ChunkMesh::set_face_slot(U32 key, U32 slot) {
+    face_slots[find_face_entry(key)] = ((U64)(key + 1) << 32) | slot;
+}
+
+void ChunkMesh::erase_face_entry(Uns pos) {
+    ///the same backward shift as in the chunk table, no tombstones
+    SizeT const mask = face_slots.len - 1;
+    Uns hole = pos;
+    Uns next = (pos + 1) & mask;
+    while(face_slots[next] != 0) {
+        Uns home = get_face_home(get_entry_key(face_slots[next]),
+                                 face_slots.len);
+        if(((next - home) & mask) >= ((next - hole) & mask)) {
+            face_slots[hole] = face_slots[next];
+            hole = next;
+        }
+        next = (next + 1) & mask;
+    }
+    face_slots[hole] = 0;
+}
+
+bool ChunkMesh::remove_face(ChkIdx idx, U8 axis) {
+    if(face_slots.len == 0) build_face_index();
+    U32 key = get_face_key(idx, axis);
+    Uns pos = find_face_entry(key);
+    if(face_slots[pos] == 0) return false;
+    U32 slot = (U32)face_slots[pos];
+    erase_face_entry(pos);
+    if(slot & PENDING_SLOT) {
+        ///the clients never got the pending ones, so the last one can take
+        ///over the slot
+        U32 list_slot = slot & ~PENDING_SLOT;
+        U32 last = added_faces.len - 1;
+        if(list_slot != last) {
+            added_faces[list_slot] = added_faces[last];
+            set_face_slot(get_face_key(added_faces[list_slot]), slot);
+        }
+        added_faces.erase(last);
+        return true;
+    }
+    ///the faces after the removed ones moved back, the slots in the index
+    ///are fixed up once in commit_updates instead
+    Uns shift = 0;
+    while(shift < removed_slots.len && removed_slots[shift] < slot) ++shift;
+    removed_slots.emplace(slot);
+    for(Uns i = removed_slots.len - 1; i > shift; --i) {
+        removed_slots[i] = removed_slots[i - 1];
+    }
+    removed_slots[shift] = slot;
+    faces.erase(slot - shift);
+    removed_faces.emplace(slot - shift);
+    return true;
+}
+
+void ChunkMesh::add_face(BlockFace const& face) {
+    if(face_slots.len == 0 ||
+       (faces.len + added_faces.len + 1) * 2 > face_slots.len) {
+        build_face_index();
+    }
+    set_face_slot(get_face_key(face), added_faces.len | PENDING_SLOT);
+    added_faces.push(face);
+}
+
+void ChunkMesh::commit_updates() {
+    Uns added_beg = faces.len;
+    for(auto const& face : added_faces) {
+        faces.push(face);
+    }
+    added_faces.clear();
+    removed_faces.clear();
+    if(face_slots.len > 0) {
+        if(removed_slots.len > 0) {
+            build_face_index();
+        } else {
+            for(Uns i = added_beg; i < faces.len; ++i) {
+                set_face_slot(get_face_key(faces[i]), i);
+            }
+        }
+    }
+}
@@ -7,110 +7,279 @@
 //
 #include <chunk_mesher.hpp>
 
-static std::thread thread;
+///the enqueued requests, taken one by one, so that a single batch gets
+///spread over all the workers
+struct MesherBatch {
+    DynArr<MesherRequest> requests;
+    Uns                   next = 0;
+};
+
+///each worker has its own results, so the workers never wait for each
+///other, and the main thread only waits for a single insertion
+struct MesherWorker {
+    std::thread   thread;
+    std::mutex    results_mutex;
+    MesherResults results;
+};
+
+static List<MesherWorker> workers;
 static std::atomic<bool> is_running;
-static List<DynArr<MesherRequest>> queue;
+static List<MesherBatch> queue;
+///requests which are queued, but not started yet, cancelled requests are
+///erased from here and then skipped by the workers
+static VecSet<ChkPos> queue_set;
+///requests which are being meshed right now
+static VecSet<ChkPos> working_set;
 static std::mutex queue_mutex;
-static std::mutex results_mutex;
 static std::condition_variable queue_cv;
-static MesherResults results;
+static std::condition_variable done_cv;
+
+typedef Arr<Block, (CHK_SIZE + 1) * (CHK_SIZE + 1) * (CHK_SIZE + 1)>
+    InputData;
+
+static Uns get_input_idx(Vec3U pos) {
+    return pos.x + (pos.y + pos.z * (CHK_SIZE + 1)) * (CHK_SIZE + 1);
+}
+
+///the chunk with the neighboring layers on the +x, +y and +z sides
+static void prepare_input(InputData& out, MesherRequest const& request) {
+    static thread_local Arr<Block, CHK_VOL> blocks;
+    request.chunks[0].get_blocks(&blocks[0]);
+    Uns src = 0;
+    for(Uns z = 0; z < CHK_SIZE; ++z) {
+        for(Uns y = 0; y < CHK_SIZE; ++y) {
+            Block* dst = &out[get_input_idx({0, y, z})];
+            for(Uns x = 0; x < CHK_SIZE; ++x) {
+                dst[x] = blocks[src++];
+            }
+        }
+    }
+    for(Uns z = 0; z < CHK_SIZE; ++z) {
+        for(Uns y = 0; y < CHK_SIZE; ++y) {
+            out[get_input_idx({CHK_SIZE, y, z})] =
+                request.chunks[1].get(to_chk_idx(IdxPos{0, y, z}));
+        }
+    }
+    for(Uns z = 0; z < CHK_SIZE; ++z) {
+        for(Uns x = 0; x < CHK_SIZE; ++x) {
+            out[get_input_idx({x, CHK_SIZE, z})] =
+                request.chunks[2].get(to_chk_idx(IdxPos{x, 0, z}));
+        }
+    }
+    for(Uns y = 0; y < CHK_SIZE; ++y) {
+        for(Uns x = 0; x < CHK_SIZE; ++x) {
+            out[get_input_idx({x, y, CHK_SIZE})] =
+                request.chunks[3].get(to_chk_idx(IdxPos{x, y, 0}));
+        }
+    }
+}
+
+///bit x of a row is set if the block (x, y, z) is not void, the bit
+///CHK_SIZE comes from the +x neighbor, the rows past CHK_SIZE from the +y
+///and +z ones
+typedef Arr<U64, (CHK_SIZE + 1) * (CHK_SIZE + 1)> SolidRows;
+static_assert(CHK_SIZE < 64, "a row with its +x neighbor has to fit a word");
+
+static Uns get_row_idx(Uns y, Uns z) {
+    return y + z * (CHK_SIZE + 1);
+}
 
-static void generate_mesh(MesherRequest const& request) {
-    ChkPos pos = request.pos;
-    if(results.count(pos) > 0) return;
+static void build_solid_rows(SolidRows& out, InputData const& input) {
+    for(Uns z = 0; z <= CHK_SIZE; ++z) {
+        for(Uns y = 0; y <= CHK_SIZE; ++y) {
+            ///the padding rows have no +x neighbor
+            Uns len = y < CHK_SIZE && z < CHK_SIZE ? CHK_SIZE + 1 : CHK_SIZE;
+            Block const* blocks = &input[get_input_idx({0, y, z})];
+            U64 row = 0;
+            for(Uns x = 0; x < len; ++x) {
+                row |= (U64)(blocks[x].id != void_block) << x;
+            }
+            out[get_row_idx(y, z)] = row;
+        }
+    }
+}
 
-    auto& mesh = results[pos];
-    mesh.faces.reserve_exactly(CHK_VOL * 3);
+///a face lies between two blocks of which exactly one is void, so the faces
+///of a whole row on each axis are the XOR of the row and its neighbor row
+static void generate_mesh(ChunkMesh& mesh, MesherRequest const& request) {
+    static thread_local InputData input;
+    static thread_local SolidRows solid;
+    ///the faces on the +x, +y and +z sides of the blocks of each row
+    static thread_local Arr<Arr<U64, 3>, CHK_SIZE * CHK_SIZE> row_faces;
+    prepare_input(input, request);
+    build_solid_rows(solid, input);
 
-    auto get_block_l = [&](Vec3U pos) -> Block const& {
-        Uns idx = pos.x + (pos.y + pos.z * (CHK_SIZE + 1)) * (CHK_SIZE + 1);
-        LUX_ASSERT(idx < arr_len(request.blocks));
-        return request.blocks[idx];
-    };
+    U64 constexpr row_mask = (1ull << CHK_SIZE) - 1;
+    SizeT faces_num = 0;
+    for(Uns z = 0; z < CHK_SIZE; ++z) {
+        for(Uns y = 0; y < CHK_SIZE; ++y) {
+            U64 row = solid[get_row_idx(y, z)];
+            auto& faces = row_faces[y + z * CHK_SIZE];
+            faces[0] = (row ^ (row >> 1)) & row_mask;
+            faces[1] = (row ^ solid[get_row_idx(y + 1, z)]) & row_mask;
+            faces[2] = (row ^ solid[get_row_idx(y, z + 1)]) & row_mask;
+            faces_num += __builtin_popcountll(faces[0]) +
+                         __builtin_popcountll(faces[1]) +
+                         __builtin_popcountll(faces[2]);
+        }
+    }
+    mesh.faces.reserve_exactly(faces_num);
 
+    ///in the z, y, x, axis order, the same as visiting every block
     Arr<IdxPos, 3> a_off = {{1, 0, 0}, {0, 1, 0}, {0, 0, 1}};
     for(Uns z = 0; z < CHK_SIZE; ++z) {
         for(Uns y = 0; y < CHK_SIZE; ++y) {
-            for(Uns x = 0; x < CHK_SIZE; ++x) {
+            auto const& faces = row_faces[y + z * CHK_SIZE];
+            U64 any = faces[0] | faces[1] | faces[2];
+            while(any != 0) {
+                Uns x = __builtin_ctzll(any);
+                any &= any - 1;
+                IdxPos idx_pos(x, y, z);
+                auto const& b0 = input[get_input_idx(idx_pos)];
+                U8 orient = b0.id != void_block;
                 for(Uns a = 0; a < 3; ++a) {
-                    IdxPos idx_pos(x, y, z);
-                    auto const& b0 = get_block_l(idx_pos);
-                    auto const& b1 = get_block_l(idx_pos + a_off[a]);
-                    if((b0.id == void_block) != (b1.id == void_block)) {
-                        U8 orient = b0.id != void_block;
-                        BlockId id = orient ? b0.id : b1.id;
-                        mesh.faces.push({to_chk_idx(idx_pos), id,
-                            (a << 1 | orient)});
-                    }
+                    if(!((faces[a] >> x) & 1)) continue;
+                    auto const& b1 = input[get_input_idx(idx_pos + a_off[a])];
+                    BlockId id = orient ? b0.id : b1.id;
+                    mesh.faces.push({to_chk_idx(idx_pos), id,
+                        (a << 1 | orient)});
                 }
             }
         }
     }
-    mesh.faces.shrink_to_fit();
 }
 
-static void thread_main() {
+static void release_request(MesherRequest& request) {
+    for(auto& snapshot : request.chunks) {
+        snapshot.release();
+    }
+}
+
+static void thread_main(MesherWorker& worker) {
     while(true) {
         std::unique_lock<std::mutex> lock(queue_mutex);
         queue_cv.wait(lock, []{return !queue.empty() || !is_running.load();});
         if(!is_running.load()) {
             break;
         }
-        results_mutex.lock();
-        auto requests = move(*queue.begin());
-        queue.pop_front();
+        auto& batch = queue.front();
+        MesherRequest request = batch.requests[batch.next++];
+        if(batch.next == batch.requests.len) {
+            queue.pop_front();
+        }
+        bool is_cancelled = queue_set.erase(request.pos) == 0;
+        if(!is_cancelled) {
+            working_set.insert(request.pos);
+        }
         lock.unlock();
-        for(auto const& request : requests) {
-            generate_mesh(request);
+        if(!is_cancelled) {
+            ChunkMesh mesh;
+            generate_mesh(mesh, request);
+            {   std::lock_guard<std::mutex> results_lock(worker.results_mutex);
+                worker.results.emplace(request.pos, move(mesh));
+            }
+            lock.lock();
+            working_set.erase(request.pos);
+            lock.unlock();
+            done_cv.notify_all();
         }
-        queue_cv.notify_one();
-        results_mutex.unlock();
+        release_request(request);
     }
 }
 
-void mesher_init() {
+void mesher_init(Uns threads_num) {
+    if(threads_num == 0) {
+        ///leave one core for the main thread
+        Uns hw_threads = std::thread::hardware_concurrency();
+        threads_num = hw_threads > 1 ? hw_threads - 1 : 1;
+    }
+    LUX_LOG("starting %zu chunk mesher threads", threads_num);
     is_running.store(true);
-    thread = std::thread(&thread_main);
+    for(Uns i = 0; i < threads_num; ++i) {
+        workers.emplace_back();
+        MesherWorker& worker = workers.back();
+        worker.thread = std::thread(&thread_main, std::ref(worker));
+    }
 }
 
 void mesher_deinit() {
     is_running.store(false);
     queue_cv.notify_all();
-    thread.join();
+    for(auto& worker : workers) {
+        worker.thread.join();
+    }
+    workers.clear();
+    for(auto& batch : queue) {
+        for(Uns i = batch.next; i < batch.requests.len; ++i) {
+            release_request(batch.requests[i]);
+        }
+    }
+    queue.clear();
+    queue_set.clear();
+}
+
+///needs queue_mutex locked, requests of chunks which are being meshed right
+///now are dropped, the newer ones would only duplicate the results
+static void push_batch(DynArr<MesherRequest>&& data, bool is_urgent) {
+    MesherBatch batch;
+    batch.requests = move(data);
+    Uns len = 0;
+    for(Uns i = 0; i < batch.requests.len; ++i) {
+        auto& request = batch.requests[i];
+        if(working_set.count(request.pos) > 0) {
+            release_request(request);
+            continue;
+        }
+        queue_set.insert(request.pos);
+        batch.requests[len++] = request;
+    }
+    batch.requests.resize(len);
+    if(len == 0) return;
+    if(is_urgent) {
+        queue.emplace_front(move(batch));
+    } else {
+        queue.emplace_back(move(batch));
+    }
 }
 
 void mesher_enqueue(DynArr<MesherRequest>&& data) {
     queue_mutex.lock();
-    queue.emplace_back(move(data));
+    push_batch(move(data), false);
     queue_mutex.unlock();
-    queue_cv.notify_one();
+    queue_cv.notify_all();
 }
 
 void mesher_enqueue_wait(DynArr<MesherRequest>&& data) {
-    queue_mutex.lock();
-    queue.emplace_front(move(data));
-    SizeT size = queue.size();
-    queue_mutex.unlock();
-    queue_cv.notify_one();
+    static DynArr<ChkPos> positions;
+    positions.clear();
+    for(auto const& request : data) {
+        positions.push(request.pos);
+    }
     std::unique_lock<std::mutex> lock(queue_mutex);
-    queue_cv.wait(lock, [&]{return queue.size() < size;});
-}
-
-bool mesher_try_lock_results(MesherResults*& out) {
-    if(results_mutex.try_lock()) {
-        out = &results;
+    push_batch(move(data), true);
+    queue_cv.notify_all();
+    ///we only wait for our own requests, the other ones might still be busy
+    done_cv.wait(lock, [&]{
+        for(auto const& pos : positions) {
+            if(queue_set.count(pos) > 0 || working_set.count(pos) > 0) {
+                return false;
+            }
+        }
         return true;
-    } else {
-        return false;
-    }
+    });
 }
 
-MesherResults& mesher_lock_results() {
-    results_mutex.lock();
-    return results;
+bool mesher_cancel(ChkPos const& pos) {
+    std::lock_guard<std::mutex> lock(queue_mutex);
+    return queue_set.erase(pos) > 0;
 }
 
-void mesher_unlock_results() {
-    results.clear();
-    results_mutex.unlock();
+void mesher_take_results(MesherResults& out) {
+    for(auto& worker : workers) {
+        std::lock_guard<std::mutex> lock(worker.results_mutex);
+        for(auto&& pair : worker.results) {
+            out.emplace(pair.first, move(pair.second));
+        }
+        worker.results.clear();
+    }
 }
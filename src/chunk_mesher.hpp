@@ -6,21 +6,25 @@
 #include <map.hpp>
 
 struct MesherRequest {
-    typedef Arr<Block, (CHK_SIZE + 1) * (CHK_SIZE + 1) * (CHK_SIZE + 1)>
-        InputData;
-
     ChkPos pos;
-    InputData blocks;
+    ///the chunk and its neighbors on the +x, +y and +z sides, the mesher
+    ///releases them once it is done with the request
+    Arr<ChunkSnapshot, 4> chunks;
 };
 
 typedef VecMap<ChkPos, ChunkMesh> MesherResults;
 
-void mesher_init();
+///threads_num of 0 uses all but one of the cores
+void mesher_init(Uns threads_num);
 void mesher_deinit();
 
 void mesher_enqueue(DynArr<MesherRequest>&& data);
+///the requests are meshed ahead of the ones queued by mesher_enqueue, waits
+///only until these are done
 void mesher_enqueue_wait(DynArr<MesherRequest>&& data);
+///returns false if the mesh is already being generated or done
+bool mesher_cancel(ChkPos const& pos);
 
-MesherResults& mesher_lock_results();
-bool mesher_try_lock_results(MesherResults*& out);
-void mesher_unlock_results();
+///moves the finished meshes of all the workers into out, each worker is
+///locked only while its meshes are moved
+void mesher_take_results(MesherResults& out);
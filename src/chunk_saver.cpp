@@ -0,0 +1,122 @@
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <algorithm>
+#include <condition_variable>
+//
+#include <lux_shared/common.hpp>
+//
+#include <region.hpp>
+#include <journal.hpp>
+#include <chunk_saver.hpp>
+
+static std::thread thread;
+static std::atomic<bool> is_running;
+static std::mutex queue_mutex;
+static std::condition_variable queue_cv;
+///the chunks waiting for the next batch, the newer version of a chunk
+///replaces the older one, so repeated edits are written once
+static VecMap<ChkPos, ChunkSnapshot> queue;
+///the batch which is being written right now, only the saver thread changes
+///it, but the loader threads read it, so it is cleared under queue_mutex
+static VecMap<ChkPos, ChunkSnapshot> batch;
+static U64 saved_num = 0;
+///the journal segment from saver_checkpoint, NO_CHECKPOINT if none
+U64 constexpr NO_CHECKPOINT = 0;
+static U64 checkpoint = NO_CHECKPOINT;
+
+static void write_batch() {
+    ///the chunks of the same region are written one after another
+    static DynArr<ChkPos> order;
+    order.clear();
+    for(auto const& pair : batch) {
+        order.push(pair.first);
+    }
+    std::sort(order.beg, order.beg + order.len,
+              [](ChkPos const& a, ChkPos const& b) {
+                  if(a.z != b.z) return a.z < b.z;
+                  if(a.y != b.y) return a.y < b.y;
+                  return a.x < b.x;
+              });
+    for(auto const& pos : order) {
+        auto const& entry = batch.at(pos);
+        region_write_chunk(pos, entry.data, entry.fill);
+    }
+    ///the chunks stay readable from the batch until they are flushed
+    region_flush();
+    saved_num += order.len;
+}
+
+static void thread_main() {
+    while(true) {
+        U64 batch_checkpoint;
+        {   std::unique_lock<std::mutex> lock(queue_mutex);
+            queue_cv.wait(lock, []{
+                return queue.size() > 0 || checkpoint != NO_CHECKPOINT ||
+                       !is_running.load();
+            });
+            if(queue.size() == 0 && checkpoint == NO_CHECKPOINT) break;
+            LUX_ASSERT(batch.size() == 0);
+            std::swap(batch, queue);
+            batch_checkpoint = checkpoint;
+            checkpoint       = NO_CHECKPOINT;
+        }
+        write_batch();
+        ///the batch holds every chunk enqueued before the checkpoint, once
+        ///it is durable the older journal segments are not needed anymore
+        if(batch_checkpoint != NO_CHECKPOINT) {
+            region_sync();
+            journal_drop_segments(batch_checkpoint);
+        }
+        {   std::lock_guard<std::mutex> lock(queue_mutex);
+            for(auto& pair : batch) {
+                pair.second.release();
+            }
+            batch.clear();
+        }
+    }
+}
+
+void saver_init() {
+    is_running.store(true);
+    thread = std::thread(&thread_main);
+}
+
+void saver_deinit() {
+    is_running.store(false);
+    queue_cv.notify_all();
+    thread.join();
+    LUX_LOG("saved %zu chunks", (SizeT)saved_num);
+}
+
+void saver_enqueue(ChkPos const& pos, ChunkSnapshot const& snapshot) {
+    {   std::lock_guard<std::mutex> lock(queue_mutex);
+        if(queue.count(pos) > 0) {
+            queue.at(pos).release();
+        }
+        queue[pos] = snapshot;
+    }
+    queue_cv.notify_one();
+}
+
+void saver_checkpoint(U64 segment) {
+    {   std::lock_guard<std::mutex> lock(queue_mutex);
+        checkpoint = segment;
+    }
+    queue_cv.notify_one();
+}
+
+bool saver_read_chunk(ChkPos const& pos, Chunk::Data*& data, Block& fill) {
+    std::lock_guard<std::mutex> lock(queue_mutex);
+    ChunkSnapshot const* entry;
+    if(queue.count(pos) > 0) {
+        entry = &queue.at(pos);
+    } else if(batch.count(pos) > 0) {
+        entry = &batch.at(pos);
+    } else {
+        return false;
+    }
+    data = entry->data != nullptr ? new Chunk::Data(*entry->data) : nullptr;
+    fill = entry->fill;
+    return true;
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+#include <lux_shared/map.hpp>
+//
+#include <map.hpp>
+
+void saver_init();
+///writes all the queued chunks before returning
+void saver_deinit();
+
+///takes over the reference of the snapshot, a newer version of the same
+///chunk replaces the one still in the queue
+void saver_enqueue(ChkPos const& pos, ChunkSnapshot const& snapshot);
+///drops the journal segments before the given one, once all the chunks
+///enqueued so far are durably written
+void saver_checkpoint(U64 segment);
+///reads the newest version of the chunk that has not been written yet,
+///returns false if there is none, data is a copy owned by the caller
+bool saver_read_chunk(ChkPos const& pos, Chunk::Data*& data, Block& fill);
@@ -0,0 +1,157 @@
+#include <new>
+//
+#include <lux_shared/common.hpp>
+//
+#include <slab_pool.hpp>
+#include <chunk_table.hpp>
+
+static SlabPool* const chunk_pool = slab_pool_create("chunk", sizeof(Chunk));
+SizeT constexpr INITIAL_CAP = 1024;
+
+///21 bits for each of the coordinates, so about a million chunks on each
+///axis, from -2^20 up to 2^20 - 1
+static U64 pack_chk_pos(ChkPos const& pos) {
+    for(Uns a = 0; a < 3; ++a) {
+        LUX_ASSERT(pos[a] >= -MAX_CHK_COORD - 1 && pos[a] <= MAX_CHK_COORD);
+    }
+    U64 constexpr mask = (1ull << 21) - 1;
+    return ((U64)pos.x & mask) |
+           (((U64)pos.y & mask) << 21) |
+           (((U64)pos.z & mask) << 42);
+}
+
+static Uns get_home_idx(U64 key, SizeT cap) {
+    U64 hash = key * 0x9e3779b97f4a7c15ull;
+    return (hash ^ (hash >> 32)) & (cap - 1);
+}
+
+ChunkTable::ChunkTable() {
+    slots.resize(INITIAL_CAP);
+    for(auto& slot : slots) {
+        slot.chunk = nullptr;
+    }
+    for(auto& slot : recent) {
+        slot.chunk = nullptr;
+    }
+}
+
+ChunkTable::~ChunkTable() {
+    clear();
+}
+
+void ChunkTable::clear() {
+    for(auto& slot : slots) {
+        if(slot.chunk != nullptr) {
+            slot.chunk->~Chunk();
+            slab_free(chunk_pool, slot.chunk);
+            slot.chunk = nullptr;
+        }
+    }
+    for(auto& slot : recent) {
+        slot.chunk = nullptr;
+    }
+    len = 0;
+}
+
+Uns ChunkTable::find_slot(U64 key) const {
+    SizeT const mask = slots.len - 1;
+    Uns idx = get_home_idx(key, slots.len);
+    while(slots[idx].chunk != nullptr && slots[idx].key != key) {
+        idx = (idx + 1) & mask;
+    }
+    return idx;
+}
+
+void ChunkTable::grow() {
+    DynArr<Slot> old_slots = move(slots);
+    slots.resize(old_slots.len * 2);
+    for(auto& slot : slots) {
+        slot.chunk = nullptr;
+    }
+    for(auto const& slot : old_slots) {
+        if(slot.chunk != nullptr) {
+            slots[find_slot(slot.key)] = slot;
+        }
+    }
+}
+
+Chunk* ChunkTable::find(ChkPos const& pos) {
+    U64 key = pack_chk_pos(pos);
+    for(auto const& slot : recent) {
+        if(slot.chunk != nullptr && slot.key == key) return slot.chunk;
+    }
+    Slot const& slot = slots[find_slot(key)];
+    if(slot.chunk != nullptr) {
+        recent[recent_next] = slot;
+        recent_next = (recent_next + 1) % RECENT_LEN;
+    }
+    return slot.chunk;
+}
+
+Chunk& ChunkTable::at(ChkPos const& pos) {
+    Chunk* chunk = find(pos);
+    LUX_ASSERT(chunk != nullptr);
+    return *chunk;
+}
+
+Chunk& ChunkTable::insert(ChkPos const& pos, bool& is_new) {
+    U64 key = pack_chk_pos(pos);
+    Uns idx = find_slot(key);
+    if(slots[idx].chunk != nullptr) {
+        is_new = false;
+        return *slots[idx].chunk;
+    }
+    if((len + 1) * 2 > slots.len) {
+        grow();
+        idx = find_slot(key);
+    }
+    Chunk* chunk = new (slab_alloc(chunk_pool)) Chunk;
+    chunk->pos = pos;
+    slots[idx] = {key, chunk};
+    len++;
+    for(Uns a = 0; a < 3; ++a) {
+        for(Uns s = 0; s < 2; ++s) {
+            ChkPos off_pos = pos;
+            off_pos[a] += s == 0 ? -1 : 1;
+            ///no need to pollute the recent chunks with these
+            Chunk* neighbor = slots[find_slot(pack_chk_pos(off_pos))].chunk;
+            chunk->neighbors[a * 2 + s] = neighbor;
+            if(neighbor != nullptr) {
+                neighbor->neighbors[a * 2 + (1 - s)] = chunk;
+            }
+        }
+    }
+    is_new = true;
+    return *chunk;
+}
+
+void ChunkTable::erase(ChkPos const& pos) {
+    Uns idx = find_slot(pack_chk_pos(pos));
+    Chunk* chunk = slots[idx].chunk;
+    LUX_ASSERT(chunk != nullptr);
+    for(auto& slot : recent) {
+        if(slot.chunk == chunk) slot.chunk = nullptr;
+    }
+    for(Uns i = 0; i < 6; ++i) {
+        if(chunk->neighbors[i] != nullptr) {
+            chunk->neighbors[i]->neighbors[i ^ 1] = nullptr;
+        }
+    }
+    chunk->~Chunk();
+    slab_free(chunk_pool, chunk);
+    len--;
+    ///the following entries are shifted back instead of leaving a tombstone,
+    ///an entry can fill the hole if the hole is between its home and itself
+    SizeT const mask = slots.len - 1;
+    Uns hole = idx;
+    Uns next = (idx + 1) & mask;
+    while(slots[next].chunk != nullptr) {
+        Uns home = get_home_idx(slots[next].key, slots.len);
+        if(((next - home) & mask) >= ((next - hole) & mask)) {
+            slots[hole] = slots[next];
+            hole = next;
+        }
+        next = (next + 1) & mask;
+    }
+    slots[hole].chunk = nullptr;
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <lux_shared/map.hpp>
+//
+#include <map.hpp>
+
+///an open addressing hash table of the loaded chunks with linear probing,
+///keyed by the packed chunk positions; the chunks are allocated separately,
+///so their addresses stay valid until they get erased
+struct ChunkTable {
+    struct Slot {
+        U64    key;
+        ///nullptr if the slot is empty
+        Chunk* chunk;
+    };
+    static Uns constexpr RECENT_LEN = 4;
+
+    DynArr<Slot> slots;
+    SizeT        len = 0;
+    ///the last few chunks found, most of the lookups hit the same ones
+    Arr<Slot, RECENT_LEN> recent;
+    Uns          recent_next = 0;
+
+    ChunkTable();
+    ~ChunkTable();
+
+    ///returns nullptr if the chunk is not loaded
+    Chunk* find(ChkPos const& pos);
+    ///the chunk has to be loaded
+    Chunk& at(ChkPos const& pos);
+    ///is_new is set if the chunk was not loaded before, the new chunk gets
+    ///linked with its loaded neighbors
+    Chunk& insert(ChkPos const& pos, bool& is_new);
+    void   erase(ChkPos const& pos);
+    ///frees all the chunks, the table can be used again afterwards
+    void   clear();
+
+    template<typename F>
+    void for_each(F&& f) {
+        for(auto const& slot : slots) {
+            if(slot.chunk != nullptr) f(*slot.chunk);
+        }
+    }
+
+    private:
+    Uns  find_slot(U64 key) const;
+    void grow();
+};
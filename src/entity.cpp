@@ -93,7 +93,10 @@ void entity_erase(EntityId entity) {
     LUX_LOG("removing entity %u", entity);
     entities.erase(entity);
     if(comps.name.count(entity)         > 0) comps.name.erase(entity);
-    if(comps.physics_body.count(entity) > 0) comps.physics_body.erase(entity);
+    if(comps.physics_body.count(entity) > 0) {
+        physics_remove_body(comps.physics_body.at(entity));
+        comps.physics_body.erase(entity);
+    }
     if(comps.model.count(entity)        > 0) comps.model.erase(entity);
 }
 
@@ -0,0 +1,255 @@
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <algorithm>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+//
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+//
+#include <lux_shared/common.hpp>
+//
+#include <journal.hpp>
+
+///stored as "ULXJ", it stays so that the older journals still replay
+U32 constexpr JOURNAL_MAGIC   = 0x4a584c55;
+U32 constexpr JOURNAL_VERSION = 1;
+SizeT constexpr HEADER_SIZE   = 2 * sizeof(U32);
+///the coordinates, the block and a checksum, a record torn by a crash ends
+///the replay of its segment
+SizeT constexpr RECORD_SIZE   = 3 * sizeof(I64) + sizeof(Block) + sizeof(U32);
+U64 constexpr NO_SEGMENT      = 0;
+SizeT constexpr NO_ROTATION   = ~(SizeT)0;
+
+static char world_path[256];
+static std::thread thread;
+static std::atomic<bool> is_running;
+static std::mutex queue_mutex;
+static std::condition_variable queue_cv;
+static DynArr<JournalRecord> queue;
+///the position in the queue at which the journal thread switches to
+///rotate_segment, NO_ROTATION if none was requested
+static SizeT rotate_idx = NO_ROTATION;
+static U64   rotate_segment;
+///the newest segment, including the requested one
+static U64   last_segment;
+///only used by the journal thread after the initialization
+static int   fd = -1;
+static std::mutex drop_mutex;
+static U64   oldest_segment;
+
+static void get_segment_path(char* out, SizeT len, U64 segment) {
+    snprintf(out, len, "%s/journal.%zu.lxj", world_path, (SizeT)segment);
+}
+
+static U32 get_checksum(U8 const* bytes, SizeT len) {
+    U32 hash = 0x811c9dc5u;
+    for(SizeT i = 0; i < len; ++i) {
+        hash ^= bytes[i];
+        hash *= 0x01000193u;
+    }
+    return hash;
+}
+
+static void write_record(U8* out, JournalRecord const& record) {
+    I64 coords[3] = {record.pos.x, record.pos.y, record.pos.z};
+    std::memcpy(out, coords, sizeof(coords));
+    std::memcpy(out + sizeof(coords), &record.block, sizeof(Block));
+    U32 checksum = get_checksum(out, RECORD_SIZE - sizeof(U32));
+    std::memcpy(out + RECORD_SIZE - sizeof(U32), &checksum, sizeof(U32));
+}
+
+static bool read_record(U8 const* in, JournalRecord& record) {
+    U32 checksum;
+    std::memcpy(&checksum, in + RECORD_SIZE - sizeof(U32), sizeof(U32));
+    if(checksum != get_checksum(in, RECORD_SIZE - sizeof(U32))) return false;
+    I64 coords[3];
+    std::memcpy(coords, in, sizeof(coords));
+    record.pos = MapPos(coords[0], coords[1], coords[2]);
+    std::memcpy(&record.block, in + sizeof(coords), sizeof(Block));
+    return true;
+}
+
+static bool write_all(int fd, void const* buff, SizeT len) {
+    U8 const* iter = (U8 const*)buff;
+    while(len > 0) {
+        ssize_t written = write(fd, iter, len);
+        if(written < 0) {
+            if(errno == EINTR) continue;
+            return false;
+        }
+        iter += written;
+        len  -= written;
+    }
+    return true;
+}
+
+///the directory is synced as well, so that the new file survives a crash
+static void open_segment(U64 segment) {
+    if(fd >= 0) close(fd);
+    char path[256];
+    get_segment_path(path, sizeof(path), segment);
+    fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644);
+    if(fd < 0) {
+        LUX_FATAL("failed to open journal %s: %s", path, strerror(errno));
+    }
+    U32 header[2] = {JOURNAL_MAGIC, JOURNAL_VERSION};
+    if(!write_all(fd, header, HEADER_SIZE) || fdatasync(fd) != 0) {
+        LUX_FATAL("failed to write journal %s: %s", path, strerror(errno));
+    }
+    int dir_fd = open(world_path, O_RDONLY | O_DIRECTORY);
+    if(dir_fd >= 0) {
+        fsync(dir_fd);
+        close(dir_fd);
+    }
+}
+
+static void write_records(JournalRecord const* records, SizeT len) {
+    if(len == 0) return;
+    static DynArr<U8> buff;
+    buff.resize(len * RECORD_SIZE);
+    for(SizeT i = 0; i < len; ++i) {
+        write_record(buff.beg + i * RECORD_SIZE, records[i]);
+    }
+    if(!write_all(fd, buff.beg, buff.len) || fdatasync(fd) != 0) {
+        LUX_LOG_ERR("failed to write %zu journal records: %s",
+                    len, strerror(errno));
+    }
+}
+
+static void thread_main() {
+    DynArr<JournalRecord> records;
+    while(true) {
+        SizeT split;
+        U64   segment;
+        {   std::unique_lock<std::mutex> lock(queue_mutex);
+            queue_cv.wait(lock, []{
+                return queue.len > 0 || rotate_idx != NO_ROTATION ||
+                       !is_running.load();
+            });
+            if(queue.len == 0 && rotate_idx == NO_ROTATION) break;
+            std::swap(records, queue);
+            split      = rotate_idx;
+            segment    = rotate_segment;
+            rotate_idx = NO_ROTATION;
+        }
+        ///everything appended during the last sync goes in a single write
+        ///followed by a single sync, so the syncs are shared by many records
+        if(split == NO_ROTATION) {
+            write_records(records.beg, records.len);
+        } else {
+            write_records(records.beg, split);
+            open_segment(segment);
+            write_records(records.beg + split, records.len - split);
+        }
+        records.clear();
+    }
+}
+
+static void read_segment(U64 segment, DynArr<JournalRecord>& out) {
+    char path[256];
+    get_segment_path(path, sizeof(path), segment);
+    FILE* file = fopen(path, "rb");
+    if(file == nullptr) {
+        LUX_LOG_ERR("failed to open journal %s: %s", path, strerror(errno));
+        return;
+    }
+    LUX_DEFER { fclose(file); };
+    U32 header[2];
+    if(fread(header, HEADER_SIZE, 1, file) != 1 ||
+       header[0] != JOURNAL_MAGIC || header[1] != JOURNAL_VERSION) {
+        LUX_LOG_WARN("ignoring invalid journal %s", path);
+        return;
+    }
+    U8 bytes[RECORD_SIZE];
+    SizeT len = 0;
+    while(fread(bytes, RECORD_SIZE, 1, file) == 1) {
+        JournalRecord record;
+        if(!read_record(bytes, record)) {
+            LUX_LOG_WARN("journal %s is torn after %zu records", path, len);
+            break;
+        }
+        out.push(record);
+        ++len;
+    }
+}
+
+U64 journal_init(char const* path, DynArr<JournalRecord>& unapplied) {
+    snprintf(world_path, sizeof(world_path), "%s", path);
+    DynArr<U64> segments;
+    {   DIR* dir = opendir(world_path);
+        if(dir == nullptr) {
+            LUX_FATAL("failed to open world directory %s: %s",
+                      world_path, strerror(errno));
+        }
+        while(dirent* entry = readdir(dir)) {
+            SizeT segment;
+            char tail;
+            if(sscanf(entry->d_name, "journal.%zu.lx%c", &segment, &tail) == 2 &&
+               tail == 'j') {
+                segments.push(segment);
+            }
+        }
+        closedir(dir);
+    }
+    std::sort(segments.beg, segments.beg + segments.len);
+    for(auto const& segment : segments) {
+        read_segment(segment, unapplied);
+    }
+    if(unapplied.len > 0) {
+        LUX_LOG("found %zu journal records in %zu segments",
+                unapplied.len, segments.len);
+    }
+    last_segment   = segments.len > 0 ? segments.last() + 1 : 1;
+    oldest_segment = segments.len > 0 ? segments[0] : last_segment;
+    open_segment(last_segment);
+    is_running.store(true);
+    thread = std::thread(&thread_main);
+    return last_segment;
+}
+
+void journal_deinit(bool is_clean) {
+    is_running.store(false);
+    queue_cv.notify_all();
+    thread.join();
+    close(fd);
+    fd = -1;
+    if(is_clean) {
+        journal_drop_segments(last_segment + 1);
+    }
+}
+
+void journal_append(MapPos const& pos, Block const& block) {
+    {   std::lock_guard<std::mutex> lock(queue_mutex);
+        queue.push({pos, block});
+    }
+    queue_cv.notify_one();
+}
+
+U64 journal_rotate() {
+    {   std::lock_guard<std::mutex> lock(queue_mutex);
+        ///the journal thread has not caught up with the last one yet
+        if(rotate_idx != NO_ROTATION) return NO_SEGMENT;
+        last_segment++;
+        rotate_idx     = queue.len;
+        rotate_segment = last_segment;
+    }
+    queue_cv.notify_one();
+    return rotate_segment;
+}
+
+void journal_drop_segments(U64 segment) {
+    std::lock_guard<std::mutex> lock(drop_mutex);
+    for(; oldest_segment < segment; ++oldest_segment) {
+        char path[256];
+        get_segment_path(path, sizeof(path), oldest_segment);
+        if(unlink(path) != 0 && errno != ENOENT) {
+            LUX_LOG_ERR("failed to delete journal %s: %s",
+                        path, strerror(errno));
+        }
+    }
+}
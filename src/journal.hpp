@@ -0,0 +1,33 @@
+#pragma once
+
+#include <lux_shared/map.hpp>
+//
+#include <map.hpp>
+
+///the block edits are appended to the journal before they reach the region
+///files, so that a crash does not lose the ones made since the last save;
+///the journal is split in segments, the ones covered by a checkpoint are
+///deleted once the chunks they changed are safely stored
+
+struct JournalRecord {
+    MapPos pos;
+    Block  block;
+};
+
+///the records of the journal left by the last run are put into unapplied,
+///in the order they were written; they have to be applied and stored before
+///calling journal_drop_segments with the returned segment, which is the
+///first one written by this run
+U64  journal_init(char const* world_path, DynArr<JournalRecord>& unapplied);
+///is_clean tells that all the records have been stored, so the journal is
+///deleted
+void journal_deinit(bool is_clean);
+
+///never blocks on the disk, the records are written and synced in batches
+///by the journal thread
+void journal_append(MapPos const& pos, Block const& block);
+///starts a new segment, the records appended before this call stay in the
+///older segments; returns the new segment
+U64  journal_rotate();
+///deletes the segments before the given one
+void journal_drop_segments(U64 segment);
@@ -3,6 +3,7 @@
 #include <mutex>
 #include <iostream>
 #include <cstdlib>
+#include <cstring>
 #include <cmath>
 #include <ctime>
 //
@@ -13,6 +14,7 @@
 #include <map.hpp>
 #include <entity.hpp>
 #include <server.hpp>
+#include <pregen.hpp>
 
 std::atomic<bool> exiting(false);
 
@@ -35,13 +37,22 @@ int main(int argc, char** argv) {
     random_seed = std::time(nullptr);
 
     U16 server_port = 31337;
+    ChkCoord pregen_radius = 0;
     { ///read commandline args
         if(argc == 1) {
             LUX_LOG("no commandline arguments given");
             LUX_LOG("assuming server port %u", server_port);
+        } else if(std::strcmp(argv[1], "--pregen") == 0) {
+            if(argc != 3) {
+                LUX_FATAL("usage: %s --pregen RADIUS", argv[0]);
+            }
+            pregen_radius = std::atol(argv[2]);
+            if(pregen_radius <= 0) {
+                LUX_FATAL("invalid radius %d given", (int)pregen_radius);
+            }
         } else {
             if(argc != 2) {
-                LUX_FATAL("usage: %s SERVER_PORT", argv[0]);
+                LUX_FATAL("usage: %s SERVER_PORT | --pregen RADIUS", argv[0]);
             }
             U64 raw_server_port = std::atol(argv[1]);
             if(raw_server_port >= 1 << 16) {
@@ -53,8 +64,12 @@ int main(int argc, char** argv) {
 
     db_init();
     constexpr F64 TICK_RATE = 64.0;
-    map_init();
+    map_init(LUX_WORLD_DIR);
     LUX_DEFER { map_deinit(); };
+    if(pregen_radius > 0) {
+        pregen_run(pregen_radius);
+        return 0;
+    }
     physics_init();
     server_init(server_port, TICK_RATE);
     LUX_DEFER { server_deinit(); };
@@ -1,43 +1,94 @@
+#include <algorithm>
 #include <cstring>
 #include <cstdlib>
 //
 #include <lux_shared/common.hpp>
 #include <lux_shared/map.hpp>
-#include <lux_shared/uninit_obj.hpp>
 //
 #include <physics.hpp>
+#include <physics_mesher.hpp>
 #include <db.hpp>
 #include <entity.hpp>
 #include <chunk_loader.hpp>
 #include <chunk_mesher.hpp>
+#include <chunk_saver.hpp>
+#include <slab_pool.hpp>
+#include <chunk_table.hpp>
+#include <region.hpp>
+#include <journal.hpp>
 #include "map.hpp"
 
-struct ChunkPhysicsMesh {
-    UninitObj<btTriangleIndexVertexArray> trigs_array;
-    UninitObj<btBvhTriangleMeshShape>     shape;
-
-    //for some reason we need to store these or bullet will crash the program
-    DynArr<Vec3F> verts;
-    DynArr<U32>   idxs;
-
-    btRigidBody* body;
-
-    ~ChunkPhysicsMesh() {
-        physics_remove_body(body);
-    }
-};
+static SlabPool* const mesh_pool =
+    slab_pool_create("chunk mesh", sizeof(ChunkMesh));
 
 static VecSet<ChkPos> mesher_requested_chunks;
-static VecMap<ChkPos, Chunk> chunks;
+///number of requesters waiting for each chunk mesh
+static VecMap<ChkPos, Uns> mesh_requests;
+static ChunkTable chunks;
+///the chunks which differ from their stored version
+static VecSet<ChkPos> dirty_chunks;
+///the physics meshes which do not match their chunk meshes anymore
+static VecSet<ChkPos> dirty_physics_meshes;
+///some edits were journaled since the last checkpoint
+static bool is_journal_dirty = false;
 
 F32 day_cycle;
 VecSet<ChkPos> updated_chunks;
 VecSet<ChkPos> updated_meshes;
-
-//needs the out.pos set
+///the number of clients holding a copy of each chunk
+static VecMap<ChkPos, U32> held_chunks;
+
+static U64 tick_num = 0;
+static DynArr<ChkPos> focus;
+///chunks this close to the focus points on every axis are never unloaded,
+///the clients can request all of them
+ChkCoord constexpr FOCUS_KEEP_DIST = MAX_REQUEST_DIST;
+U64      constexpr UNLOAD_TIMEOUT  = LUX_CHUNK_UNLOAD_SECS * 64;
+SizeT    constexpr CHUNKS_MEMORY_BUDGET =
+    (SizeT)LUX_CHUNK_MEMORY_MB * 1024 * 1024;
+///the dirty chunks are handed to the saver this often
+U64      constexpr SAVE_INTERVAL   = 5 * 64;
+///the dirty physics meshes handed to the physics mesher in a single tick,
+///the ones closest to the focus points go first
+Uns      constexpr PHYSICS_REBUILDS_PER_TICK = 16;
+
+//needs the out.pos set, returns false if the mesh is known to be empty
 static bool prepare_mesher_data(MesherRequest& out);
 static bool is_chunk_loaded(ChkPos const& pos) {
-    return chunks.count(pos) > 0;
+    return chunks.find(pos) != nullptr;
+}
+
+static void add_mesher_result(ChkPos const& pos, ChunkMesh&& mesh) {
+    auto& chunk = chunks.at(pos);
+    ///a chunk requested again while its first result was waiting to be
+    ///taken gets meshed twice
+    if(chunk.mesh_state != Chunk::NOT_BUILT) return;
+    ///the mesher finds the empty meshes which prepare_mesher_data could not
+    if(mesh.faces.len == 0) {
+        chunk.mesh_state = Chunk::BUILT_EMPTY;
+    } else {
+        chunk.mesh = new ChunkMesh(move(mesh));
+        chunk.mesh_state = Chunk::BUILT_TRIANGLE;
+    }
+    mesher_requested_chunks.erase(pos);
+}
+
+static void add_loader_results(LoaderResults const& results) {
+    for(auto const& pair : results) {
+        bool is_new;
+        auto& chunk = chunks.insert(pair.first, is_new);
+        if(!is_new) {
+            ///the loaded version might have been changed already
+            delete pair.second.data;
+            continue;
+        }
+        chunk.data        = pair.second.data;
+        chunk.fill        = pair.second.fill;
+        chunk.last_access = tick_num;
+        if(pair.second.is_modified) {
+            dirty_chunks.insert(pair.first);
+        }
+    }
 }
 
 static void write_suspended_block(MapPos const& pos, Block block) {
@@ -46,34 +97,128 @@ static void write_suspended_block(MapPos const& pos, Block block) {
     if(is_chunk_loaded(chk_pos)) {
         updated_chunks.insert(chk_pos);
         Chunk& chk = chunks.at(chk_pos);
-        chk[chk_idx] = block;
+        chk.set_block(chk_idx, block);
         chk.updated_blocks.insert(chk_idx);
+        dirty_chunks.insert(chk_pos);
     } else {
         loader_write_suspended_block(block, pos);
     }
 }
 
-void map_init() {
-    loader_init();
-    mesher_init();
+///applies the edits which did not reach the region files before a crash,
+///the records are in the order they were made, so the newest edit wins
+static void replay_journal(Slice<JournalRecord> const& records) {
+    VecMap<ChkPos, DynArr<BlockChange>> changes;
+    for(auto const& record : records) {
+        changes[to_chk_pos(record.pos)].push(
+            {to_chk_idx(record.pos), record.block});
+    }
+    auto apply_changes = [](Chunk::Data*& data, Block const& fill,
+                            DynArr<BlockChange> const& chunk_changes) {
+        for(auto const& change : chunk_changes) {
+            if(data == nullptr) {
+                if(change.block.id == fill.id) continue;
+                data = new Chunk::Data(fill);
+            }
+            data->set(change.idx, change.block);
+        }
+    };
+    DynArr<ChkPos> missing;
+    for(auto const& pair : changes) {
+        Chunk::Data* data;
+        Block fill;
+        if(!region_read_chunk(pair.first, data, fill)) {
+            missing.push(pair.first);
+            continue;
+        }
+        apply_changes(data, fill, pair.second);
+        region_write_chunk(pair.first, data, fill);
+        delete data;
+    }
+    ///the chunks which never got stored are generated right away, so that
+    ///their edits reach the region files before the journal is dropped
+    if(missing.len > 0) {
+        loader_enqueue_wait(missing);
+        LoaderResults const& results = loader_lock_results();
+        for(auto const& pair : results) {
+            Chunk::Data* data = pair.second.data;
+            if(changes.count(pair.first) > 0) {
+                apply_changes(data, pair.second.fill, changes.at(pair.first));
+                region_write_chunk(pair.first, data, pair.second.fill);
+            }
+            delete data;
+        }
+        loader_unlock_results();
+    }
+    LUX_LOG("replayed %zu journal records of %zu chunks, %zu were generated",
+            records.len, changes.size(), (SizeT)missing.len);
+}
+
+void map_init(char const* world_path) {
+    region_init(world_path);
+    ///the replay might need to generate chunks
+    loader_init(LUX_LOADER_THREADS, LUX_HEIGHT_CACHE_MB * 1024 * 1024,
+                LUX_COLD_CHUNKS_MB * 1024 * 1024);
+    {   DynArr<JournalRecord> unapplied;
+        U64 segment = journal_init(world_path, unapplied);
+        if(unapplied.len > 0) {
+            replay_journal({unapplied.beg, unapplied.len});
+            region_sync();
+        }
+        journal_drop_segments(segment);
+    }
+    mesher_init(LUX_MESHER_THREADS);
+    physics_mesher_init();
+    saver_init();
 }
 
 void map_deinit() {
     mesher_deinit();
+    physics_mesher_deinit();
     loader_deinit();
+    ///the chunks are not used anymore, so their data is handed over as-is
+    for(auto const& pos : dirty_chunks) {
+        Chunk& chunk = chunks.at(pos);
+        saver_enqueue(pos, {chunk.data, chunk.fill});
+        chunk.data = nullptr;
+    }
+    dirty_chunks.clear();
+    ///so are the loaded chunks which were not taken yet
+    {   LoaderResults const& results = loader_lock_results();
+        for(auto const& pair : results) {
+            if(pair.second.is_modified) {
+                saver_enqueue(pair.first, {pair.second.data, pair.second.fill});
+            } else {
+                delete pair.second.data;
+            }
+        }
+        loader_unlock_results();
+    }
+    ///freed here and not by the static destructors, which run after the
+    ///thread caches of the slab pools are gone
+    chunks.clear();
+    saver_deinit();
+    region_deinit();
+    ///the edits of the chunks which were never loaded only exist in the
+    ///journal, it is replayed on the next start
+    journal_deinit(!loader_has_block_changes());
+    slab_log_stats();
+}
+
+void map_set_focus(Slice<MapPos> const& map_focus) {
+    focus.resize(map_focus.len);
+    for(Uns i = 0; i < map_focus.len; ++i) {
+        focus[i] = to_chk_pos(map_focus[i]);
+    }
+    loader_set_focus(focus);
 }
 
 void guarantee_chunk(ChkPos const& pos) {
     if(!is_chunk_loaded(pos)) {
         ChkPos l_pos = pos;
         loader_enqueue_wait({&l_pos, 1});
-        {   auto const& results = loader_lock_results();
-            for(auto const& pair : results) {
-                auto& chunk = chunks[pair.first];
-                chunk.data = move(pair.second);
-            }
-            loader_unlock_results();
-        }
+        add_loader_results(loader_lock_results());
+        loader_unlock_results();
     }
 }
 
@@ -88,19 +233,61 @@ bool try_guarantee_chunk(ChkPos const& pos) {
 
 ChunkMesh::ChunkMesh(ChunkMesh&& that) {
     faces = move(that.faces);
+    face_slots = move(that.face_slots);
     physics_mesh = that.physics_mesh;
     that.physics_mesh = nullptr;
 }
 
-Block &Chunk::operator[](ChkIdx idx) {
-    return data->blocks[idx];
+void* ChunkMesh::operator new(SizeT size) {
+    LUX_ASSERT(size == sizeof(ChunkMesh));
+    return slab_alloc(mesh_pool);
+}
+
+void ChunkMesh::operator delete(void* ptr) {
+    slab_free(mesh_pool, ptr);
+}
+
+Block Chunk::operator[](ChkIdx idx) const {
+    if(data == nullptr) return fill;
+    return data->get(idx);
+}
+
+void Chunk::set_block(ChkIdx idx, Block const& block) {
+    if(data == nullptr) {
+        if(block.id == fill.id) return;
+        data = new Data(fill);
+    } else if(data->is_shared()) {
+        if(data->get(idx).id == block.id) return;
+        Data* copy = new Data(*data);
+        data->release();
+        data = copy;
+    }
+    data->set(idx, block);
 }
 
-Block const &Chunk::operator[](ChkIdx idx) const {
-    return data->blocks[idx];
+ChunkSnapshot Chunk::get_snapshot() const {
+    return {data != nullptr ? data->acquire() : nullptr, fill};
+}
+
+void ChunkSnapshot::get_blocks(Block* out) const {
+    if(data == nullptr) {
+        for(Uns i = 0; i < CHK_VOL; ++i) {
+            out[i] = fill;
+        }
+    } else {
+        data->get_all(out);
+    }
+}
+
+void ChunkSnapshot::release() {
+    if(data != nullptr) {
+        data->release();
+        data = nullptr;
+    }
 }
 
 Chunk::~Chunk() {
+    if(data != nullptr) data->release();
     switch(mesh_state) {
         case BUILT_PHYSICS: {
             delete mesh->physics_mesh;
@@ -126,28 +313,83 @@ void enqueue_missing_chunks_meshes(VecSet<ChkPos> const& requests) {
     }*/
 }
 
+///returns the chunks needed to build the mesh of pos that are not loaded yet
+static Slice<ChkPos> get_missing_mesh_chunks(Arr<ChkPos, 4>& positions,
+                                             ChkPos const& pos) {
+    Slice<ChkPos> slice = {positions, 0};
+    if(!is_chunk_loaded(pos)) {
+        slice[slice.len++] = pos;
+    }
+    Arr<ChkPos, 3> offs {{1, 0, 0}, {0, 1, 0}, {0, 0, 1}};
+    for(ChkPos const& off : offs) {
+        if(!is_chunk_loaded(pos + off)) {
+            slice[slice.len++] = pos + off;
+        }
+    }
+    return slice;
+}
+
+void hold_chunk(ChkPos const& pos) {
+    held_chunks[pos]++;
+}
+
+void release_chunk(ChkPos const& pos) {
+    LUX_ASSERT(held_chunks.count(pos) > 0);
+    auto& refs = held_chunks.at(pos);
+    LUX_ASSERT(refs > 0);
+    refs--;
+    if(refs == 0) {
+        held_chunks.erase(pos);
+    }
+}
+
+void request_chunk_mesh(ChkPos const& pos) {
+    if(mesh_requests[pos]++ == 0) {
+        Arr<ChkPos, 4> positions;
+        Slice<ChkPos> slice = get_missing_mesh_chunks(positions, pos);
+        if(slice.len > 0) {
+            loader_enqueue(slice);
+        }
+    }
+}
+
+void release_chunk_mesh(ChkPos const& pos) {
+    LUX_ASSERT(mesh_requests.count(pos) > 0);
+    auto& refs = mesh_requests.at(pos);
+    LUX_ASSERT(refs > 0);
+    refs--;
+    if(refs == 0) {
+        mesh_requests.erase(pos);
+        ///the chunks cannot be unloaded while the request is active, so all
+        ///of the chunks missing right now have been enqueued by us
+        Arr<ChkPos, 4> positions;
+        Slice<ChkPos> slice = get_missing_mesh_chunks(positions, pos);
+        if(slice.len > 0) {
+            loader_cancel(slice);
+        }
+        if(mesher_requested_chunks.count(pos) > 0 && mesher_cancel(pos)) {
+            mesher_requested_chunks.erase(pos);
+        }
+    }
+}
+
 bool try_guarantee_chunk_mesh(ChkPos const& pos) {
     if(mesher_requested_chunks.count(pos) > 0) {
         return false;
     }
-    Arr<ChkPos, 4> positions;
-    Slice<ChkPos> slice = {positions, 0};
     if(is_chunk_loaded(pos)) {
         Chunk& chunk = chunks.at(pos);
         if(chunk.mesh_state != Chunk::NOT_BUILT) {
             return true;
         }
-    } else {
-        slice[slice.len++] = pos;
-    }
-    Arr<ChkPos, 3> offs {{1, 0, 0}, {0, 1, 0}, {0, 0, 1}};
-    for(ChkPos const& off : offs) {
-        if(!is_chunk_loaded(pos + off)) {
-            slice[slice.len++] = pos + off;
-        }
     }
+    Arr<ChkPos, 4> positions;
+    Slice<ChkPos> slice = get_missing_mesh_chunks(positions, pos);
     if(slice.len > 0) {
-        loader_enqueue(slice);
+        ///requested meshes have their chunks enqueued already
+        if(mesh_requests.count(pos) == 0) {
+            loader_enqueue(slice);
+        }
         return false;
     }
     DynArr<MesherRequest> mesher_requests(1);
@@ -165,53 +407,42 @@ bool try_guarantee_chunk_mesh(ChkPos const& pos) {
     }
 }
 
+///the faces the mesh will have once the pending updates are committed
+static void get_physics_faces(DynArr<BlockFace>& out, ChunkMesh const& mesh) {
+    out.clear();
+    out.reserve_exactly(mesh.faces.len + mesh.added_faces.len);
+    for(auto const& face : mesh.faces) {
+        out.push(face);
+    }
+    for(auto const& face : mesh.added_faces) {
+        out.push(face);
+    }
+}
+
+///the old body stays in the world until the new one is added, so the
+///collision never has a gap; a mesh without faces has no physics mesh
+static void swap_physics_mesh(ChkPos const& pos, ChunkMesh& mesh,
+                              ChunkPhysicsMesh* p_mesh) {
+    if(p_mesh != nullptr) {
+        p_mesh->body = physics_create_mesh(to_map_pos(pos, 0), &*p_mesh->shape);
+    }
+    delete mesh.physics_mesh;
+    mesh.physics_mesh = p_mesh;
+}
+
 static void chunk_physics_mesh_build(ChkPos const& pos) {
     auto& chunk = chunks.at(pos);
     if(chunk.mesh_state == Chunk::BUILT_TRIANGLE) {
         auto& mesh = *chunk.mesh;
-        chunk.mesh->physics_mesh = new ChunkPhysicsMesh();
-        auto& p_mesh = *chunk.mesh->physics_mesh;
-        Uns faces_num = mesh.faces.len;
-        LUX_ASSERT(faces_num > 0);
-        p_mesh.verts.resize(faces_num * 4);
-        p_mesh.idxs.resize(faces_num * 6);
-        Arr<Vec3F, 3 * 4> vert_offs = {
-            {0, 0, 0}, {0, 1, 0}, {0, 0, 1}, {0, 1, 1},
-            {0, 0, 0}, {0, 0, 1}, {1, 0, 0}, {1, 0, 1},
-            {0, 0, 0}, {1, 0, 0}, {0, 1, 0}, {1, 1, 0},
-        };
-        for(Uns i = 0; i < faces_num; ++i) {
-            auto const& face = mesh.faces[i];
-            ChkIdx idx = face.idx;
-            U8 axis = (face.orientation & 0b110) >> 1;
-            LUX_ASSERT(axis != 0b11);
-            U8 sign = (face.orientation & 1);
-            Vec3F face_off(0);
-            face_off[axis] = 1;
-            if(sign) {
-                for(Uns j = 0; j < 6; ++j) {
-                    p_mesh.idxs[i * 6 + j] = quad_idxs<U16>[j] + i * 4;
-                }
-            } else {
-                for(Uns j = 0; j < 6; ++j) {
-                    p_mesh.idxs[i * 6 + j] = quad_idxs<U16>[5 - j] + i * 4;
-                }
-            }
-            for(Uns j = 0; j < 4; ++j) {
-                auto& vert = p_mesh.verts[i * 4 + j];
-                vert = (Vec3F)to_idx_pos(idx) + face_off +
-                    vert_offs[axis * 4 + j];
+        if(mesh.added_faces.len == 0) {
+            if(mesh.faces.len > 0) {
+                swap_physics_mesh(pos, mesh, physics_mesh_build(mesh.faces));
             }
+        } else {
+            static DynArr<BlockFace> faces;
+            get_physics_faces(faces, mesh);
+            swap_physics_mesh(pos, mesh, physics_mesh_build(faces));
         }
-        p_mesh.trigs_array.init(
-            faces_num * 2, (I32*)p_mesh.idxs.beg , sizeof(I32) * 3,
-            p_mesh.verts.len, (F32*)p_mesh.verts.beg, sizeof(Vec3F));
-
-        p_mesh.shape.init(
-            &*p_mesh.trigs_array, true, btVector3{0, 0, 0},
-            btVector3{CHK_SIZE, CHK_SIZE, CHK_SIZE});
-
-        p_mesh.body = physics_create_mesh(to_map_pos(pos, 0), &*p_mesh.shape);
         chunk.mesh_state = Chunk::BUILT_PHYSICS;
     }
 }
@@ -277,11 +508,7 @@ void guarantee_physics_mesh_for_aabb(MapPos const& min, MapPos const& max) {
     }
     if(loader_requests.len > 0) {
         loader_enqueue_wait(loader_requests);
-        auto const& results = loader_lock_results();
-        for(auto const& pair : results) {
-            auto& chunk = chunks[pair.first];
-            chunk.data = pair.second;
-        }
+        add_loader_results(loader_lock_results());
         loader_unlock_results();
     }
 
@@ -306,16 +533,12 @@ void guarantee_physics_mesh_for_aabb(MapPos const& min, MapPos const& max) {
     }
     if(mesher_requests.len > 0) {
         mesher_enqueue_wait(move(mesher_requests));
-        auto& meshes = mesher_lock_results();
-        for(auto&& pair : meshes) {
-            auto& chunk = chunks.at(pair.first);
-            LUX_ASSERT(chunk.mesh_state == Chunk::NOT_BUILT);
-            chunk.mesh = new ChunkMesh(move(pair.second));
-            LUX_ASSERT(chunk.mesh->faces.len > 0);
-            chunk.mesh_state = Chunk::BUILT_TRIANGLE;
-            mesher_requested_chunks.erase(pair.first);
+        static MesherResults results;
+        mesher_take_results(results);
+        for(auto&& pair : results) {
+            add_mesher_result(pair.first, move(pair.second));
         }
-        mesher_unlock_results();
+        results.clear();
     }
 
     //finally we build the physics meshes
@@ -329,19 +552,23 @@ void guarantee_physics_mesh_for_aabb(MapPos const& min, MapPos const& max) {
 }
 
 Chunk const& get_chunk(ChkPos const& pos) {
-    LUX_ASSERT(is_chunk_loaded(pos));
-    ///wish there was a non-bound-checking way to do it
-    return chunks.at(pos);
+    Chunk& chunk = chunks.at(pos);
+    chunk.last_access = tick_num;
+    return chunk;
 }
 
-Block& write_block(MapPos const& pos) {
+void write_block(MapPos const& pos, Block const& block) {
     ChkPos chk_pos = to_chk_pos(pos);
     LUX_ASSERT(is_chunk_loaded(chk_pos));
     updated_chunks.emplace(chk_pos);
     Chunk& chunk = chunks.at(chk_pos);
+    chunk.last_access = tick_num;
+    dirty_chunks.insert(chk_pos);
+    journal_append(pos, block);
+    is_journal_dirty = true;
     ChkIdx chk_idx = to_chk_idx(pos);
     chunk.updated_blocks.insert(chk_idx);
-    return chunk[chk_idx];
+    chunk.set_block(chk_idx, block);
 }
 
 Block get_block(MapPos const& pos) {
@@ -354,80 +581,257 @@ BlockBp const& get_block_bp(MapPos const& pos) {
 
 static void chunk_mesh_update(ChkPos const& chk_pos);
 
+static U64 get_focus_dist(ChkPos const& pos) {
+    U64 min_dist = ~(U64)0;
+    for(auto const& f_pos : focus) {
+        ChkPos diff = pos - f_pos;
+        U64 dist = diff.x * diff.x + diff.y * diff.y + diff.z * diff.z;
+        min_dist = min(min_dist, dist);
+    }
+    return min_dist;
+}
+
+static bool is_near_focus(ChkPos const& pos) {
+    for(auto const& f_pos : focus) {
+        ChkPos diff = abs(pos - f_pos);
+        if(diff.x <= FOCUS_KEEP_DIST &&
+           diff.y <= FOCUS_KEEP_DIST &&
+           diff.z <= FOCUS_KEEP_DIST) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static SizeT get_chunk_memory(Chunk const& chunk) {
+    SizeT size = sizeof(Chunk);
+    if(chunk.data != nullptr) size += chunk.data->get_memory();
+    if(chunk.mesh_state == Chunk::BUILT_TRIANGLE ||
+       chunk.mesh_state == Chunk::BUILT_PHYSICS) {
+        auto const& mesh = *chunk.mesh;
+        size += sizeof(ChunkMesh) + mesh.faces.len * sizeof(BlockFace) +
+            mesh.face_slots.len * sizeof(U64);
+    }
+    if(chunk.mesh_state == Chunk::BUILT_PHYSICS &&
+       chunk.mesh->physics_mesh != nullptr) {
+        auto const& p_mesh = *chunk.mesh->physics_mesh;
+        size += sizeof(ChunkPhysicsMesh) +
+            p_mesh.verts.len * sizeof(Vec3F) + p_mesh.idxs.len * sizeof(U32);
+    }
+    return size;
+}
+
+///pinned chunks are still needed by someone, even if nobody accessed them
+static bool is_chunk_pinned(ChkPos const& pos) {
+    if(mesher_requested_chunks.count(pos) > 0 ||
+       mesh_requests.count(pos) > 0 ||
+       updated_chunks.count(pos) > 0 ||
+       updated_meshes.count(pos) > 0 ||
+       held_chunks.count(pos) > 0) {
+        return true;
+    }
+    ///the meshes of the chunks on the negative sides depend on this chunk
+    for(Uns a = 0; a < 3; ++a) {
+        ChkPos off_pos = pos;
+        off_pos[a]--;
+        if(mesh_requests.count(off_pos) > 0 ||
+           mesher_requested_chunks.count(off_pos) > 0) {
+            return true;
+        }
+        if(is_chunk_loaded(off_pos) &&
+           chunks.at(off_pos).mesh_state != Chunk::NOT_BUILT) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void unload_chunk(ChkPos const& pos) {
+    Chunk& chunk = chunks.at(pos);
+    loader_store_cold(pos, chunk.data, chunk.fill);
+    if(dirty_chunks.count(pos) > 0) {
+        ///the chunk is going away, so its reference is handed over
+        saver_enqueue(pos, {chunk.data, chunk.fill});
+        chunk.data = nullptr;
+        dirty_chunks.erase(pos);
+    }
+    if(dirty_physics_meshes.count(pos) > 0) {
+        dirty_physics_meshes.erase(pos);
+    }
+    physics_mesher_cancel(pos);
+    ///the destructor frees the data, the meshes and the physics body
+    chunks.erase(pos);
+}
+
+struct UnloadCandidate {
+    ChkPos pos;
+    ///~0 for the chunks which timed out
+    U64    dist;
+    SizeT  memory;
+};
+
+///unloads the chunks which were not accessed for UNLOAD_TIMEOUT ticks, then
+///the farthest ones from the focus points until the memory budget is met,
+///the chunks within FOCUS_KEEP_DIST of them on every axis and the chunks
+///held by the clients are never unloaded
+static void unload_chunks() {
+    static DynArr<UnloadCandidate> candidates;
+    candidates.clear();
+    SizeT memory = 0;
+    Uns unloaded_num = 0;
+    chunks.for_each([&](Chunk& chunk) {
+        SizeT chunk_memory = get_chunk_memory(chunk);
+        memory += chunk_memory;
+        if(is_near_focus(chunk.pos)) {
+            chunk.last_access = tick_num;
+            return;
+        }
+        ///it is safe to erase only after the iteration
+        if(tick_num - chunk.last_access > UNLOAD_TIMEOUT) {
+            candidates.push({chunk.pos, ~(U64)0, chunk_memory});
+        } else {
+            candidates.push({chunk.pos, get_focus_dist(chunk.pos),
+                             chunk_memory});
+        }
+    });
+    ///the timed out chunks go first, then the farthest ones; chunks on the
+    ///negative sides go before their neighbors, which they might be pinning
+    std::sort(candidates.beg, candidates.beg + candidates.len,
+              [](UnloadCandidate const& a, UnloadCandidate const& b) {
+                  if(a.dist != b.dist) return a.dist > b.dist;
+                  return a.pos.x + a.pos.y + a.pos.z <
+                         b.pos.x + b.pos.y + b.pos.z;
+              });
+    for(auto const& candidate : candidates) {
+        if(candidate.dist != ~(U64)0 && memory <= CHUNKS_MEMORY_BUDGET) {
+            break;
+        }
+        if(is_chunk_pinned(candidate.pos)) continue;
+        unload_chunk(candidate.pos);
+        memory -= candidate.memory;
+        unloaded_num++;
+    }
+    if(memory > CHUNKS_MEMORY_BUDGET) {
+        LUX_LOG_WARN("chunks use %zuMB over the memory budget, "
+                     "the rest of them is pinned or near the players",
+                     (memory - CHUNKS_MEMORY_BUDGET) / (1024 * 1024));
+    }
+    if(unloaded_num > 0) {
+        LUX_LOG("unloaded %zu chunks, %zuMB in use", unloaded_num,
+                memory / (1024 * 1024));
+    }
+}
+
+///only takes snapshots of the dirty chunks, the saver thread writes them to
+///the disk
+static void save_chunks() {
+    for(auto const& pos : dirty_chunks) {
+        saver_enqueue(pos, chunks.at(pos).get_snapshot());
+    }
+    dirty_chunks.clear();
+    ///the snapshots above cover every edit journaled so far, including the
+    ///ones of the chunks unloaded in the meantime
+    if(is_journal_dirty) {
+        U64 segment = journal_rotate();
+        if(segment != 0) {
+            saver_checkpoint(segment);
+            is_journal_dirty = false;
+        }
+    }
+}
+
+///the rebuilt meshes finished since the last tick are swapped in, then the
+///next few dirty ones are sent to the physics mesher
+static void update_physics_meshes() {
+    {   static PhysicsMesherResults results;
+        physics_mesher_take_results(results);
+        for(auto const& pair : results) {
+            Chunk* chunk = chunks.find(pair.first);
+            if(chunk == nullptr || chunk->mesh_state != Chunk::BUILT_PHYSICS) {
+                delete pair.second;
+                continue;
+            }
+            swap_physics_mesh(pair.first, *chunk->mesh, pair.second);
+        }
+        results.clear();
+    }
+    static DynArr<ChkPos> order;
+    order.clear();
+    for(auto const& pos : dirty_physics_meshes) {
+        order.push(pos);
+    }
+    if(order.len > PHYSICS_REBUILDS_PER_TICK) {
+        std::partial_sort(order.beg, order.beg + PHYSICS_REBUILDS_PER_TICK,
+                          order.beg + order.len,
+                          [](ChkPos const& a, ChkPos const& b) {
+                              return get_focus_dist(a) < get_focus_dist(b);
+                          });
+        order.resize(PHYSICS_REBUILDS_PER_TICK);
+    }
+    for(auto const& pos : order) {
+        dirty_physics_meshes.erase(pos);
+        ChunkMesh& mesh = *chunks.at(pos).mesh;
+        DynArr<BlockFace> faces;
+        get_physics_faces(faces, mesh);
+        if(faces.len == 0) {
+            ///nothing to rebuild, a late mesh of the older faces is dropped
+            physics_mesher_cancel(pos);
+            swap_physics_mesh(pos, mesh, nullptr);
+        } else {
+            physics_mesher_enqueue(pos, move(faces));
+        }
+    }
+}
+
 void map_tick() {
     benchmark("tick", 1.0 / 64.0, [&](){
     {   LoaderResults* results;
         if(loader_try_lock_results(results)) {
-            for(auto const& pair : *results) {
-                auto& chunk = chunks[pair.first];
-                chunk.data = pair.second;
-            }
+            add_loader_results(*results);
             loader_unlock_results();
         }
     }
-    {   LoaderBlockChanges* block_changes;
-        if(loader_try_lock_block_changes(block_changes)) {
-            for(auto it = block_changes->begin(), end = block_changes->end();
-                     it != end;) {
-                if(is_chunk_loaded(it->first)) {
-                    auto& chunk = chunks.at(it->first);
-                    updated_chunks.insert(it->first);
-                    for(auto const& change : it->second) {
-                        chunk[change.idx] = change.block;
-                        chunk.updated_blocks.insert(change.idx);
-                    }
-                    it = block_changes->erase(it);
-                } else ++it;
-            }
-            loader_unlock_block_changes();
-        }
-    }
-    {   MesherResults* results;
-        if(mesher_try_lock_results(results)) {
-            MesherResults& bob = *results;
-            for(auto&& pair : bob) {
-                auto& chunk = chunks.at(pair.first);
-                LUX_ASSERT(chunk.mesh_state == Chunk::NOT_BUILT);
-                chunk.mesh = new ChunkMesh(move(pair.second));
-                chunk.mesh_state = Chunk::BUILT_TRIANGLE;
-                mesher_requested_chunks.erase(pair.first);
+    {   static LoaderBlockChanges block_changes;
+        loader_take_block_changes(block_changes, &is_chunk_loaded);
+        for(auto const& pair : block_changes) {
+            auto& chunk = chunks.at(pair.first);
+            updated_chunks.insert(pair.first);
+            dirty_chunks.insert(pair.first);
+            for(auto const& change : pair.second) {
+                chunk.set_block(change.idx, change.block);
+                chunk.updated_blocks.insert(change.idx);
             }
-            mesher_unlock_results();
         }
+        block_changes.clear();
+    }
+    {   static MesherResults results;
+        mesher_take_results(results);
+        for(auto&& pair : results) {
+            add_mesher_result(pair.first, move(pair.second));
+        }
+        results.clear();
     }
     });
 
     benchmark("chunk updates", 1.0 / 64.0, [&](){
     for(auto const& pos : updated_chunks) {
-        //@URGENT
-        //LUX_UNIMPLEMENTED(); //@TODO physics
-        /*if(physics_meshes.count(pos) > 0) {
-            U8 updated_sides = 0b000000;
-            LUX_ASSERT(is_chunk_loaded(pos));
-            Chunk const& chunk = get_chunk(pos);
-            for(auto const& idx : chunk.updated_blocks) {
-                IdxPos idx_pos = to_idx_pos(idx);
-                for(Uns a = 0; a < 3; ++a) {
-                    if(idx_pos[a] == 0) {
-                        updated_sides |= (0b000001 << (a * 2));
-                    } else if(idx_pos[a] == CHK_SIZE - 1) {
-                        updated_sides |= (0b000010 << (a * 2));
-                    }
-                }
-            }
-            auto update_mesh = [&](ChkPos const& r_pos) {
-                ChkPos off_pos = r_pos + pos;
-                if(physics_meshes.count(off_pos) > 0) {
-                    build_physics_mesh(off_pos);
-                }
-            };
-            update_chunks_around(update_mesh, updated_sides);
-        }*/
         chunk_mesh_update(pos);
     }
+    ///covers the neighbors whose meshes changed because of a border block
+    for(auto const& pos : updated_meshes) {
+        if(chunks.at(pos).mesh_state == Chunk::BUILT_PHYSICS) {
+            dirty_physics_meshes.insert(pos);
+        }
+    }
     });
     updated_chunks.clear();
-    static Uns tick_num = 0;
+    benchmark("physics updates", 1.0 / 64.0, [&](){update_physics_meshes();});
+    if(tick_num % 64 == 0) {
+        benchmark("chunk unloading", 1.0 / 64.0, [&](){unload_chunks();});
+    }
+    if(tick_num % SAVE_INTERVAL == 0) {
+        benchmark("chunk saving", 1.0 / 64.0, [&](){save_chunks();});
+    }
     physics_tick(1.f / 64.f); //TODO tick time
     Uns constexpr ticks_per_day = 64 * 60 * 24;
     day_cycle = std::sin(tau *
@@ -456,9 +860,11 @@ bool map_cast_ray(MapPos* out_pos, Vec3F* out_dir, Vec3F src, Vec3F dst) {
     for(Uns i = 0; i < max; ++i) {
         for(Uns j = 0; j < 3; ++j) {
             MapPos map_pos = floor(it);
-            ChkPos chk_pos = to_chk_pos(map_pos);
-            if(!is_chunk_loaded(chk_pos)) return false;
-            if(get_chunk(chk_pos)[to_chk_idx(map_pos)].id != void_block) {
+            ///the consecutive steps mostly stay in the same chunk, which the
+            ///table remembers
+            Chunk const* chunk = chunks.find(to_chk_pos(map_pos));
+            if(chunk == nullptr) return false;
+            if((*chunk)[to_chk_idx(map_pos)].id != void_block) {
                 *out_pos = map_pos;
                 Vec3F norm(0.f);
                 norm[max_i] = sign(ray[max_i]);
@@ -480,119 +886,67 @@ static void chunk_mesh_update(ChkPos const& chk_pos) {
         return;
     }
     ChunkMesh& mesh = *chunk.mesh;
+    ///adds the face between b0 at idx and b1 on its positive side of axis a
+    auto add_face = [&](ChunkMesh& mesh, ChkPos const& pos, ChkIdx idx,
+                        Block const& b0, Block const& b1, Uns a) {
+        if((b0.id == void_block) != (b1.id == void_block)) {
+            U8 orient = b0.id != void_block;
+            BlockId id = orient ? b0.id : b1.id;
+            mesh.add_face({idx, id, (U8)(((U8)a << 1) | orient)});
+            updated_meshes.insert(pos);
+        }
+    };
     for(auto const& idx : chunk.updated_blocks) {
         IdxPos i_pos = to_idx_pos(idx);
         auto const& b0 = chunk[idx];
-        Uns removed_count = 0;
-        //@TODO in this function, we will probably need something more efficient
-        //than linear search of the faces
-        for(Uns i = 0; i < mesh.faces.len;) {
-            auto const& face = mesh.faces[i];
-            if(face.idx == idx) {
-                mesh.faces.erase(i);
-                mesh.removed_faces.emplace(i);
+        for(Uns a = 0; a < 3; ++a) {
+            if(mesh.remove_face(idx, a)) {
                 updated_meshes.insert(chk_pos);
-                removed_count++;
-            } else ++i;
-            if(removed_count == 3) break;
+            }
         }
         for(Uns a = 0; a < 3; ++a) {
+            ///the face on the negative side belongs to the neighboring block
             if(i_pos[a] == 0) {
                 ChkPos off_pos = chk_pos;
                 off_pos[a]--;
-                if(is_chunk_loaded(off_pos)) {
-                    Chunk& off_chunk = chunks.at(off_pos);
-                    if(off_chunk.mesh_state != Chunk::NOT_BUILT) {
-                        if(off_chunk.mesh_state == Chunk::BUILT_EMPTY) {
-                            //@URGENT
-                    //        LUX_UNIMPLEMENTED();
-                            continue;
-                        }
+                if(chunk.neighbors[a * 2] != nullptr) {
+                    Chunk const& off_chunk = *chunk.neighbors[a * 2];
+                    if(off_chunk.mesh_state == Chunk::BUILT_EMPTY) {
+                        //@URGENT
+                //        LUX_UNIMPLEMENTED();
+                    } else if(off_chunk.mesh_state != Chunk::NOT_BUILT) {
                         ChunkMesh& off_mesh = *off_chunk.mesh;
                         IdxPos off_i_pos = i_pos;
                         off_i_pos[a] = CHK_SIZE - 1;
-                        for(Uns i = 0; i < off_mesh.faces.len;) {
-                            auto const& face = off_mesh.faces[i];
-                            if(to_idx_pos(face.idx) == off_i_pos &&
-                               (face.orientation & 0b110) >> 1 == a) {
-                                off_mesh.faces.erase(i);
-                                off_mesh.removed_faces.emplace(i);
-                                updated_meshes.insert(off_pos);
-                                break;
-                            } else ++i;
-                        }
                         ChkIdx off_idx = to_chk_idx(off_i_pos);
-                        auto const& b1 = off_chunk[off_idx];
-                        if((b0.id == void_block) != (b1.id == void_block)) {
-                            U8 orient = b0.id == void_block;
-                            BlockId id = not orient ? b0.id : b1.id;
-                            off_mesh.faces.push({off_idx, id, (((U8)a << 1) | orient)});
-                            off_mesh.added_faces.emplace(off_mesh.faces.last());
+                        if(off_mesh.remove_face(off_idx, a)) {
                             updated_meshes.insert(off_pos);
                         }
-                    }
-                }
-                {   IdxPos off_i_pos = i_pos;
-                    off_i_pos[a]++;
-                    auto const& b1 = chunk[to_chk_idx(off_i_pos)];
-                    if((b0.id == void_block) != (b1.id == void_block)) {
-                        U8 orient = b0.id != void_block;
-                        BlockId id = orient ? b0.id : b1.id;
-                        mesh.faces.push({idx, id, (((U8)a << 1) | orient)});
-                        mesh.added_faces.emplace(mesh.faces.last());
-                        updated_meshes.insert(chk_pos);
+                        add_face(off_mesh, off_pos, off_idx,
+                                 off_chunk[off_idx], b0, a);
                     }
                 }
             } else {
-                {   IdxPos off_i_pos = i_pos;
-                    off_i_pos[a]--;
-                    ChkIdx off_idx = to_chk_idx(off_i_pos);
-                    for(Uns i = 0; i < mesh.faces.len;) {
-                        auto const& face = mesh.faces[i];
-                        if(face.idx == off_idx &&
-                           (face.orientation & 0b110) >> 1 == a) {
-                            mesh.faces.erase(i);
-                            mesh.removed_faces.emplace(i);
-                            updated_meshes.insert(chk_pos);
-                            break;
-                        } else ++i;
-                    }
-                    auto const& b1 = chunk[off_idx];
-                    if((b0.id == void_block) != (b1.id == void_block)) {
-                        U8 orient = b0.id == void_block;
-                        BlockId id = not orient ? b0.id : b1.id;
-                        mesh.faces.push({off_idx, id, (((U8)a << 1) | orient)});
-                        mesh.added_faces.emplace(mesh.faces.last());
-                        updated_meshes.insert(chk_pos);
-                    }
-                }
-                if(i_pos[a] == CHK_SIZE - 1) {
-                    ChkPos off_pos = chk_pos;
-                    off_pos[a]++;
-                    LUX_ASSERT(is_chunk_loaded(off_pos));
-                    Chunk& off_chunk = chunks.at(off_pos);
-                    IdxPos off_i_pos = i_pos;
-                    off_i_pos[a] = 0;
-                    auto const& b1 = off_chunk[to_chk_idx(off_i_pos)];
-                    if((b0.id == void_block) != (b1.id == void_block)) {
-                        U8 orient = b0.id != void_block;
-                        BlockId id = orient ? b0.id : b1.id;
-                        mesh.faces.push({idx, id, (((U8)a << 1) | orient)});
-                        mesh.added_faces.emplace(mesh.faces.last());
-                        updated_meshes.insert(chk_pos);
-                    }
-                } else {
-                    IdxPos off_i_pos = i_pos;
-                    off_i_pos[a]++;
-                    auto const& b1 = chunk[to_chk_idx(off_i_pos)];
-                    if((b0.id == void_block) != (b1.id == void_block)) {
-                        U8 orient = b0.id != void_block;
-                        BlockId id = orient ? b0.id : b1.id;
-                        mesh.faces.push({idx, id, (((U8)a << 1) | orient)});
-                        mesh.added_faces.emplace(mesh.faces.last());
-                        updated_meshes.insert(chk_pos);
-                    }
+                IdxPos off_i_pos = i_pos;
+                off_i_pos[a]--;
+                ChkIdx off_idx = to_chk_idx(off_i_pos);
+                if(mesh.remove_face(off_idx, a)) {
+                    updated_meshes.insert(chk_pos);
                 }
+                add_face(mesh, chk_pos, off_idx, chunk[off_idx], b0, a);
+            }
+            if(i_pos[a] == CHK_SIZE - 1) {
+                LUX_ASSERT(chunk.neighbors[a * 2 + 1] != nullptr);
+                Chunk const& off_chunk = *chunk.neighbors[a * 2 + 1];
+                IdxPos off_i_pos = i_pos;
+                off_i_pos[a] = 0;
+                add_face(mesh, chk_pos, idx,
+                         b0, off_chunk[to_chk_idx(off_i_pos)], a);
+            } else {
+                IdxPos off_i_pos = i_pos;
+                off_i_pos[a]++;
+                add_face(mesh, chk_pos, idx,
+                         b0, chunk[to_chk_idx(off_i_pos)], a);
             }
         }
     }
@@ -600,66 +954,27 @@ static void chunk_mesh_update(ChkPos const& chk_pos) {
 }
 
 static bool prepare_mesher_data(MesherRequest& out) {
-    ChkPos const& pos = out.pos;
-    bool has_any_faces = false;
-    bool face_check;
-    auto get_block_l = [&](Vec3I pos) -> Block& {
-        Uns idx = pos.x + (pos.y + pos.z * (CHK_SIZE + 1)) * (CHK_SIZE + 1);
-        LUX_ASSERT(idx < arr_len(out.blocks));
-        return out.blocks[idx];
-    };
-    {   Chunk const& chk = get_chunk(pos + ChkPos(1, 0, 0));
-        {   auto const& block =
-                chk[to_chk_idx(IdxPos{0, 0, 0})];
-            get_block_l({CHK_SIZE, 0, 0}) = block;
-            face_check = block.id == void_block;
-        }
-        for(Uns y = 1; y < CHK_SIZE; ++y) {
-            auto const& block = chk[to_chk_idx(IdxPos{0, y, 0})];
-            get_block_l({CHK_SIZE, y, 0}) = block;
-            has_any_faces |= (block.id == void_block) != face_check;
-        }
-        for(Uns z = 1; z < CHK_SIZE; ++z) {
-            for(Uns y = 0; y < CHK_SIZE; ++y) {
-                auto const& block = chk[to_chk_idx(IdxPos{0, y, z})];
-                get_block_l({CHK_SIZE, y, z}) = block;
-                has_any_faces |= (block.id == void_block) != face_check;
-            }
-        }
-    }
-    {   Chunk const& chk = get_chunk(pos + ChkPos(0, 1, 0));
-        for(Uns z = 0; z < CHK_SIZE; ++z) {
-            for(Uns x = 0; x < CHK_SIZE; ++x) {
-                auto const& block = chk[to_chk_idx(IdxPos{x, 0, z})];
-                get_block_l({x, CHK_SIZE, z}) = block;
-                has_any_faces |= (block.id == void_block) != face_check;
-            }
-        }
-    }
-    {   Chunk const& chk = get_chunk(pos + ChkPos(0, 0, 1));
-        for(Uns y = 0; y < CHK_SIZE; ++y) {
-            for(Uns x = 0; x < CHK_SIZE; ++x) {
-                auto const& block = chk[to_chk_idx(IdxPos{x, y, 0})];
-                get_block_l({x, y, CHK_SIZE}) = block;
-                has_any_faces |= (block.id == void_block) != face_check;
-            }
-        }
-    }
-    Chunk const& chk = get_chunk(pos);
-    Uns src = 0;
-    Uns dst = 0;
-    for(Uns z = 0; z < CHK_SIZE; ++z) {
-        for(Uns y = 0; y < CHK_SIZE; ++y) {
-            for(Uns x = 0; x < CHK_SIZE; ++x) {
-                auto const& block = chk[src];
-                out.blocks[dst] = block;
-                has_any_faces |= (block.id == void_block) != face_check;
-                src++;
-                dst++;
-            }
-            dst++;
+    Chunk const& center = get_chunk(out.pos);
+    ///the chunks on the positive sides are loaded, see get_missing_mesh_chunks
+    Chunk const& chk_x = *center.neighbors[1];
+    Chunk const& chk_y = *center.neighbors[3];
+    Chunk const& chk_z = *center.neighbors[5];
+    {   ///a uniform chunk has no faces if its neighbours are uniform as well
+        auto is_uniform = [&](Chunk const& chk, bool is_void) {
+            return chk.data == nullptr && (chk.fill.id == void_block) == is_void;
+        };
+        bool is_void = center.fill.id == void_block;
+        if(is_uniform(center, is_void) &&
+           is_uniform(chk_x, is_void) &&
+           is_uniform(chk_y, is_void) &&
+           is_uniform(chk_z, is_void)) {
+            return false;
         }
-        dst += CHK_SIZE + 1;
     }
-    return has_any_faces;
+    ///the mesher copies the blocks out of the snapshots on its own thread
+    out.chunks[0] = center.get_snapshot();
+    out.chunks[1] = chk_x.get_snapshot();
+    out.chunks[2] = chk_y.get_snapshot();
+    out.chunks[3] = chk_z.get_snapshot();
+    return true;
 }
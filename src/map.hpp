@@ -1,5 +1,7 @@
 #pragma once
 
+#include <atomic>
+//
 #include <lux_shared/map.hpp>
 //
 #include <db.hpp>
@@ -9,24 +11,112 @@ struct Block {
 };
 
 struct ChunkPhysicsMesh;
+struct ChunkSnapshot;
 
 struct ChunkMesh {
+    ///the clients erase removed_faces from their faces first, in that order
+    ///and keeping the order of the rest, and then append added_faces
     DynArr<BlockFace> faces;
     DynArr<Uns>       removed_faces;
     DynArr<BlockFace> added_faces;
+    ///an open addressing table from the block and axis of every face to its
+    ///slot in faces, or in added_faces if PENDING_SLOT is set; it is built
+    ///on the first update, most of the meshes never get one
+    DynArr<U64>       face_slots;
+    ///the slots of the faces removed since the index was last refreshed,
+    ///sorted, the faces after them are that many positions back
+    DynArr<U32>       removed_slots;
 
-    ChunkPhysicsMesh* physics_mesh;
+    ///nullptr if the mesh has no faces to collide with
+    ChunkPhysicsMesh* physics_mesh = nullptr;
 
     ChunkMesh() = default;
     ChunkMesh(ChunkMesh&& that);
+    static void* operator new(SizeT size);
+    static void  operator delete(void* ptr);
+
+    ///returns false if there is no face between the block and its neighbor
+    ///on the positive side of axis
+    bool remove_face(ChkIdx idx, U8 axis);
+    void add_face(BlockFace const& face);
+    ///moves added_faces into faces, once the updates have been sent
+    void commit_updates();
+
+    private:
+    static U32 constexpr PENDING_SLOT = 1u << 31;
+    void build_face_index();
+    Uns  find_face_entry(U32 key) const;
+    void set_face_slot(U32 key, U32 slot);
+    void erase_face_entry(Uns pos);
 };
 
 struct Chunk {
+    ///the blocks are stored as indices into a palette, bit-packed with 1, 2
+    ///or 4 bits per block, chunks with more than MAX_PALETTE_LEN different
+    ///blocks fall back to a flat array
     struct Data {
-        Arr<Block, CHK_VOL> blocks;
+        static Uns constexpr MAX_PALETTE_LEN = 16;
+
+        Arr<Block, MAX_PALETTE_LEN> palette;
+        U8            palette_len = 0;
+        ///0 if the palette has a single entry
+        U8            bits    = 0;
+        bool          is_flat = false;
+        ///CHK_VOL * bits / 64 words, nullptr if bits is 0
+        U64*          words   = nullptr;
+        ///CHK_VOL blocks, nullptr unless is_flat
+        Block*        flat    = nullptr;
+        ///the owner and the snapshots hold a reference each, shared data is
+        ///never written to, see Chunk::set_block
+        mutable std::atomic<U32> refs{1};
+
+        Data(Block const& fill);
+        Data(Data const& that);
+        Data& operator=(Data const& that) = delete;
+        ~Data();
+        ///the data and its blocks are allocated from slab pools
+        static void* operator new(SizeT size);
+        static void  operator delete(void* ptr);
+
+        Block get(ChkIdx idx) const {
+            if(is_flat) return flat[idx];
+            if(bits == 0) return palette[0];
+            Uns bit = (Uns)idx * bits;
+            return palette[(words[bit / 64] >> (bit % 64)) &
+                           ((1ull << bits) - 1)];
+        }
+        void set(ChkIdx idx, Block const& block);
+        ///bulk access to all CHK_VOL blocks, in the to_chk_idx order
+        void get_all(Block* out) const;
+        void set_all(Block const* in);
+        SizeT get_memory() const;
+
+        Data const* acquire() const {
+            refs.fetch_add(1, std::memory_order_relaxed);
+            return this;
+        }
+        ///the data is deleted along with the last reference
+        void release() const;
+        bool is_shared() const {
+            return refs.load(std::memory_order_acquire) > 1;
+        }
+
+        private:
+        void set_bits(U8 new_bits);
+        void set_flat();
+        void free_blocks();
     };
-    //@URGENT we need to deallocate this (using lux_dealloc) when unloading
-    Data* data;
+    ChkPos pos;
+    ///the loaded neighbors in the -x, +x, -y, +y, -z, +z order, nullptr for
+    ///the ones which are not loaded, kept up to date by the chunk table
+    Arr<Chunk*, 6> neighbors;
+    ///nullptr if every block of the chunk is equal to fill,
+    ///set_block allocates it on the first write
+    Data* data = nullptr;
+    Block fill = {void_block};
+    ///the map tick of the last access, chunks which are not accessed for
+    ///a while get unloaded
+    U64   last_access = 0;
     IdSet<ChkIdx> updated_blocks;
     ChunkMesh* mesh;
 
@@ -37,26 +127,62 @@ struct Chunk {
         BUILT_PHYSICS
     } mesh_state = NOT_BUILT;
 
-    Block       &operator[](ChkIdx idx);
-    Block const &operator[](ChkIdx idx) const;
+    Block operator[](ChkIdx idx) const;
+    ///copies the data first if a snapshot still holds it
+    void  set_block(ChkIdx idx, Block const& block);
+    ChunkSnapshot get_snapshot() const;
     ~Chunk();
 };
 
+///an immutable view of the blocks of a chunk, which the worker threads can
+///read while the main thread keeps writing to the chunk
+struct ChunkSnapshot {
+    ///nullptr if every block is equal to fill
+    Chunk::Data const* data;
+    Block              fill;
+
+    Block get(ChkIdx idx) const {
+        return data == nullptr ? fill : data->get(idx);
+    }
+    ///writes all CHK_VOL blocks to out, in the to_chk_idx order
+    void  get_blocks(Block* out) const;
+    void  release();
+};
+
 extern F32 day_cycle;
 extern VecSet<ChkPos> updated_meshes;
 
+///the chunks can be loaded from -MAX_CHK_COORD - 1 up to MAX_CHK_COORD on
+///each axis, the chunk table keys hold 21 bits of every coordinate
+ChkCoord constexpr MAX_CHK_COORD = (1 << 20) - 1;
+///pending chunk requests further away from the player than this on any axis
+///get cancelled, the chunks closer than that stay loaded
+ChkCoord constexpr MAX_REQUEST_DIST = 16;
+
 Block get_block(MapPos const& pos);
 BlockBp const& get_block_bp(MapPos const& pos);
 
-void map_init();
+///the world is stored in the world_path directory
+void map_init(char const* world_path);
 void map_deinit();
 void map_tick();
+///the positions of players, the map gets loaded around them first
+void map_set_focus(Slice<MapPos> const& focus);
 void guarantee_chunk(ChkPos const& pos);
 bool try_guarantee_chunk(ChkPos const& pos);
 bool try_guarantee_chunk_mesh(ChkPos const& pos);
+///holds a reference to the mesh request, the chunks get loaded and meshed
+///in the background, try_guarantee_chunk_mesh returns true once it is done
+void request_chunk_mesh(ChkPos const& pos);
+///the chunk stays loaded while a client holds a copy of it, so that the
+///client keeps getting its updates
+void hold_chunk(ChkPos const& pos);
+void release_chunk(ChkPos const& pos);
+///drops the reference, the work is cancelled if nobody else needs it
+void release_chunk_mesh(ChkPos const& pos);
 void enqueue_missing_chunks_meshes(VecSet<ChkPos> const& requests);
 void guarantee_physics_mesh_for_aabb(MapPos const& min, MapPos const& max);
 Chunk const& get_chunk(ChkPos const& pos);
-Block& write_block(MapPos const& pos);
+void write_block(MapPos const& pos, Block const& block);
 
 bool map_cast_ray(MapPos* out_pos, Vec3F* out_dir, Vec3F src, Vec3F dst);
@@ -7,9 +7,6 @@ static btSequentialImpulseConstraintSolver solver;
 static btDiscreteDynamicsWorld             world(&dispatcher, &broadphase,
                                                  &solver, &collision_conf);
 
-static List<btDefaultMotionState> motion_states;
-static List<btRigidBody> bodies;
-
 static btCapsuleShapeZ body_shape(0.8, 3.8);
 
 void physics_init() {
@@ -17,29 +14,31 @@ void physics_init() {
 }
 
 btRigidBody* physics_create_body(EntityVec const& pos) {
-    motion_states.emplace_back(btTransform({0, 0, 0, 1}, {pos.x, pos.y, pos.z}));
-    btRigidBody::btRigidBodyConstructionInfo ci(1, &motion_states.back(),
+    auto* motion_state = new btDefaultMotionState(
+        btTransform({0, 0, 0, 1}, {pos.x, pos.y, pos.z}));
+    btRigidBody::btRigidBodyConstructionInfo ci(1, motion_state,
         &body_shape, btVector3(0, 0, 0));
     ci.m_friction = 1.0;
-    bodies.emplace_back(ci);
-    btRigidBody &body = bodies.back();
-    body.forceActivationState(DISABLE_DEACTIVATION);
-    world.addRigidBody(&body);
-    return &body;
+    btRigidBody* body = new btRigidBody(ci);
+    body->forceActivationState(DISABLE_DEACTIVATION);
+    world.addRigidBody(body);
+    return body;
 }
 
 btRigidBody* physics_create_mesh(MapPos const& pos, btCollisionShape* shape) {
-    motion_states.emplace_back(btTransform({0, 0, 0, 1}, {pos.x, pos.y, pos.z}));
-    btRigidBody::btRigidBodyConstructionInfo ci(0, &motion_states.back(),
+    auto* motion_state = new btDefaultMotionState(
+        btTransform({0, 0, 0, 1}, {pos.x, pos.y, pos.z}));
+    btRigidBody::btRigidBodyConstructionInfo ci(0, motion_state,
         shape, btVector3(0, 0, 0));
-    bodies.emplace_back(ci);
-    btRigidBody& body = bodies.back();
-    world.addRigidBody(&body);
-    return &body;
+    btRigidBody* body = new btRigidBody(ci);
+    world.addRigidBody(body);
+    return body;
 }
 
 void physics_remove_body(btRigidBody* body) {
     world.removeRigidBody(body);
+    delete body->getMotionState();
+    delete body;
 }
 
 void physics_tick(F32 time) {
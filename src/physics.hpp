@@ -11,5 +11,6 @@ typedef U16 PhysicsBodyId;
 void physics_init();
 btRigidBody* physics_create_body(EntityVec const& pos);
 btRigidBody* physics_create_mesh(MapPos const& pos, btCollisionShape* shape);
+///removes the body from the world and frees it along with its motion state
 void physics_remove_body(btRigidBody* body);
 void physics_tick(F32 time);
@@ -0,0 +1,184 @@
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <cstring>
+#include <condition_variable>
+//
+#include <lux_shared/common.hpp>
+//
+#include <slab_pool.hpp>
+#include <physics_mesher.hpp>
+
+static SlabPool* const physics_mesh_pool =
+    slab_pool_create("physics mesh", sizeof(ChunkPhysicsMesh));
+
+static std::thread thread;
+static std::atomic<bool> is_running;
+static std::mutex queue_mutex;
+static std::condition_variable queue_cv;
+///the newer faces of a chunk replace the older ones, so a chunk edited
+///many times in a row is rebuilt once
+static VecMap<ChkPos, DynArr<BlockFace>> queue;
+static PhysicsMesherResults results;
+///the chunk being built right now, its mesh is thrown away if it gets
+///cancelled in the meantime
+static bool   is_working = false;
+static ChkPos working_pos;
+static bool   is_working_cancelled;
+
+void* ChunkPhysicsMesh::operator new(SizeT size) {
+    LUX_ASSERT(size == sizeof(ChunkPhysicsMesh));
+    return slab_alloc(physics_mesh_pool);
+}
+
+void ChunkPhysicsMesh::operator delete(void* ptr) {
+    slab_free(physics_mesh_pool, ptr);
+}
+
+///the faces of each axis, orientation and layer are merged greedily into
+///rectangles, the collision does not care about the block types, so a flat
+///floor becomes a single quad instead of two triangles per block
+static void build_collision_quads(DynArr<Vec3F>& verts, DynArr<U32>& idxs,
+                                  Slice<BlockFace> const& faces) {
+    static_assert(CHK_SIZE < 64, "a row of faces has to fit a word");
+    ///bit u of row v is set if there is a face at the u coordinate on the
+    ///(axis + 1) % 3 axis and v on the (axis + 2) % 3 axis
+    typedef Arr<U64, CHK_SIZE> Layer;
+    static thread_local Arr<Arr<Arr<Layer, CHK_SIZE>, 2>, 3> layers;
+    std::memset(&layers, 0, sizeof(layers));
+    for(auto const& face : faces) {
+        U8 axis = (face.orientation & 0b110) >> 1;
+        LUX_ASSERT(axis != 0b11);
+        U8 sign = face.orientation & 1;
+        IdxPos idx_pos = to_idx_pos(face.idx);
+        layers[axis][sign][idx_pos[axis]][idx_pos[(axis + 2) % 3]] |=
+            1ull << idx_pos[(axis + 1) % 3];
+    }
+    verts.clear();
+    idxs.clear();
+    for(Uns axis = 0; axis < 3; ++axis) {
+        Uns const u_axis = (axis + 1) % 3;
+        Uns const v_axis = (axis + 2) % 3;
+        for(Uns sign = 0; sign < 2; ++sign) {
+            for(Uns d = 0; d < CHK_SIZE; ++d) {
+                Layer& rows = layers[axis][sign][d];
+                for(Uns v = 0; v < CHK_SIZE; ++v) {
+                    while(rows[v] != 0) {
+                        Uns u = __builtin_ctzll(rows[v]);
+                        Uns w = __builtin_ctzll(~(rows[v] >> u));
+                        U64 run = ((1ull << w) - 1) << u;
+                        rows[v] &= ~run;
+                        Uns h = 1;
+                        while(v + h < CHK_SIZE && (rows[v + h] & run) == run) {
+                            rows[v + h] &= ~run;
+                            ++h;
+                        }
+                        U32 base = verts.len;
+                        for(Uns j = 0; j < 6; ++j) {
+                            idxs.push(base + quad_idxs<U16>[sign ? j : 5 - j]);
+                        }
+                        ///in the same corner order as a single face
+                        Vec3F origin(0);
+                        origin[axis]   = d + 1;
+                        origin[u_axis] = u;
+                        origin[v_axis] = v;
+                        for(Uns j = 0; j < 4; ++j) {
+                            Vec3F vert = origin;
+                            vert[u_axis] += (j & 1) * w;
+                            vert[v_axis] += (j >> 1) * h;
+                            verts.push(vert);
+                        }
+                    }
+                }
+            }
+        }
+    }
+}
+
+ChunkPhysicsMesh* physics_mesh_build(Slice<BlockFace> const& faces) {
+    LUX_ASSERT(faces.len > 0);
+    ChunkPhysicsMesh* p_mesh = new ChunkPhysicsMesh();
+    build_collision_quads(p_mesh->verts, p_mesh->idxs, faces);
+    p_mesh->trigs_array.init(
+        p_mesh->idxs.len / 3, (I32*)p_mesh->idxs.beg , sizeof(I32) * 3,
+        p_mesh->verts.len, (F32*)p_mesh->verts.beg, sizeof(Vec3F));
+
+    p_mesh->shape.init(
+        &*p_mesh->trigs_array, true, btVector3{0, 0, 0},
+        btVector3{CHK_SIZE, CHK_SIZE, CHK_SIZE});
+    return p_mesh;
+}
+
+static void thread_main() {
+    DynArr<BlockFace> faces;
+    while(true) {
+        {   std::unique_lock<std::mutex> lock(queue_mutex);
+            queue_cv.wait(lock, []{
+                return queue.size() > 0 || !is_running.load();
+            });
+            if(queue.size() == 0) break;
+            auto it = queue.begin();
+            working_pos = it->first;
+            faces = move(it->second);
+            queue.erase(it);
+            is_working           = true;
+            is_working_cancelled = false;
+        }
+        ChunkPhysicsMesh* p_mesh = physics_mesh_build(faces);
+        {   std::lock_guard<std::mutex> lock(queue_mutex);
+            is_working = false;
+            if(is_working_cancelled) {
+                delete p_mesh;
+                continue;
+            }
+            ///the older mesh from the previous request was not taken yet
+            if(results.count(working_pos) > 0) {
+                delete results.at(working_pos);
+            }
+            results[working_pos] = p_mesh;
+        }
+    }
+}
+
+void physics_mesher_init() {
+    is_running.store(true);
+    thread = std::thread(&thread_main);
+}
+
+void physics_mesher_deinit() {
+    {   std::lock_guard<std::mutex> lock(queue_mutex);
+        queue.clear();
+    }
+    is_running.store(false);
+    queue_cv.notify_all();
+    thread.join();
+    for(auto const& pair : results) {
+        delete pair.second;
+    }
+    results.clear();
+}
+
+void physics_mesher_enqueue(ChkPos const& pos, DynArr<BlockFace>&& faces) {
+    {   std::lock_guard<std::mutex> lock(queue_mutex);
+        queue[pos] = move(faces);
+    }
+    queue_cv.notify_one();
+}
+
+void physics_mesher_cancel(ChkPos const& pos) {
+    std::lock_guard<std::mutex> lock(queue_mutex);
+    queue.erase(pos);
+    if(results.count(pos) > 0) {
+        delete results.at(pos);
+        results.erase(pos);
+    }
+    if(is_working && working_pos == pos) {
+        is_working_cancelled = true;
+    }
+}
+
+void physics_mesher_take_results(PhysicsMesherResults& out) {
+    std::lock_guard<std::mutex> lock(queue_mutex);
+    LUX_ASSERT(out.size() == 0);
+    std::swap(out, results);
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <lux_shared/common.hpp>
+#include <lux_shared/map.hpp>
+#include <lux_shared/uninit_obj.hpp>
+//
+#include <physics.hpp>
+#include <map.hpp>
+
+struct ChunkPhysicsMesh {
+    UninitObj<btTriangleIndexVertexArray> trigs_array;
+    UninitObj<btBvhTriangleMeshShape>     shape;
+
+    //for some reason we need to store these or bullet will crash the program
+    DynArr<Vec3F> verts;
+    DynArr<U32>   idxs;
+
+    ///nullptr until the mesh is added to the world
+    btRigidBody* body = nullptr;
+
+    static void* operator new(SizeT size);
+    static void  operator delete(void* ptr);
+
+    ~ChunkPhysicsMesh() {
+        if(body != nullptr) physics_remove_body(body);
+        (&*shape)->~btBvhTriangleMeshShape();
+        (&*trigs_array)->~btTriangleIndexVertexArray();
+    }
+};
+
+typedef VecMap<ChkPos, ChunkPhysicsMesh*> PhysicsMesherResults;
+
+///builds the shape from the faces of a chunk mesh, without touching the
+///world, so it can be called from any thread
+ChunkPhysicsMesh* physics_mesh_build(Slice<BlockFace> const& faces);
+
+///the physics meshes of the edited chunks are rebuilt by a single thread,
+///the main thread only swaps the finished ones into the world
+void physics_mesher_init();
+void physics_mesher_deinit();
+
+///a newer version of the same chunk replaces the one still in the queue
+void physics_mesher_enqueue(ChkPos const& pos, DynArr<BlockFace>&& faces);
+///drops the queued request and the result, the mesh being built right now
+///is dropped once it is done
+void physics_mesher_cancel(ChkPos const& pos);
+///moves the finished meshes into out, the caller owns them
+void physics_mesher_take_results(PhysicsMesherResults& out);
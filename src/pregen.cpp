@@ -0,0 +1,70 @@
+#include <chrono>
+#include <algorithm>
+//
+#include <lux_shared/common.hpp>
+//
+#include <chunk_loader.hpp>
+#include <chunk_saver.hpp>
+#include <pregen.hpp>
+
+typedef std::chrono::steady_clock Clock;
+
+///the results of a batch are held in memory until it is done
+SizeT constexpr BATCH_LEN = 4096;
+
+static F64 get_seconds(Clock::time_point const& since) {
+    return std::chrono::duration<F64>(Clock::now() - since).count();
+}
+
+void pregen_run(ChkCoord radius) {
+    ///the columns go one after another, so that their height chunks are
+    ///generated once and still cached for the neighboring columns
+    DynArr<ChkPos> region;
+    I64 const radius_sq = (I64)radius * (I64)radius;
+    for(ChkCoord y = -radius; y <= radius; ++y) {
+        for(ChkCoord x = -radius; x <= radius; ++x) {
+            for(ChkCoord z = -radius; z <= radius; ++z) {
+                if((I64)x * x + (I64)y * y + (I64)z * z <= radius_sq) {
+                    region.push({x, y, z});
+                }
+            }
+        }
+    }
+    LUX_LOG("pregenerating %zu chunks in radius %d",
+            (SizeT)region.len, (int)radius);
+
+    auto start = Clock::now();
+    F64 last_report = 0.0;
+    for(SizeT i = 0; i < region.len; i += BATCH_LEN) {
+        SizeT len = min(BATCH_LEN, region.len - i);
+        loader_enqueue_wait({region.beg + i, len});
+        ///the chunks are stored by the loader already, nothing else needs
+        ///them in memory, except the ones which got suspended changes
+        ///applied, they differ from the stored version
+        {   LoaderResults const& results = loader_lock_results();
+            for(auto const& pair : results) {
+                if(pair.second.is_modified) {
+                    saver_enqueue(pair.first,
+                                  {pair.second.data, pair.second.fill});
+                } else {
+                    delete pair.second.data;
+                }
+            }
+            loader_unlock_results();
+        }
+        F64 time = get_seconds(start);
+        if(time - last_report >= 1.0 || i + len == region.len) {
+            last_report = time;
+            LUX_LOG("%zu/%zu chunks, %.1f%%, %.1f chunks/s",
+                    i + len, (SizeT)region.len,
+                    100.0 * (F64)(i + len) / (F64)region.len,
+                    (F64)(i + len) / time);
+        }
+    }
+
+    F64 time = get_seconds(start);
+    LoaderStats stats = loader_get_stats();
+    LUX_LOG("pregenerated %zu chunks in %.3fs, %.1f chunks/s, "
+            "%zu were stored already", (SizeT)region.len, time,
+            (F64)region.len / time, (SizeT)stats.chunks_read);
+}
@@ -0,0 +1,8 @@
+#pragma once
+
+#include <lux_shared/map.hpp>
+
+///generates and stores every chunk within radius chunks of the origin, so
+///that the server reads them from the region files instead of generating
+///them when the players join; needs map_init, without any map ticks
+void pregen_run(ChkCoord radius);
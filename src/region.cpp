@@ -0,0 +1,475 @@
+#include <mutex>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <cstddef>
+//
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+//
+#include <lux_shared/common.hpp>
+//
+#include <chunk_codec.hpp>
+#include <region.hpp>
+
+///the files start with the characters in this order, on a little endian cpu
+static constexpr U32 get_magic(char const (&str)[5]) {
+    return (U32)str[0] | (U32)str[1] << 8 | (U32)str[2] << 16 |
+        (U32)str[3] << 24;
+}
+
+U32 constexpr REGION_MAGIC   = get_magic("LUXR");
+U32 constexpr WORLD_MAGIC    = get_magic("LUXW");
+U32 constexpr REGION_VERSION = 4;
+Uns constexpr REGION_VOL     = REGION_SIZE * REGION_SIZE * REGION_SIZE;
+///the records get some slack, so that they can grow a bit in their slots
+U32 constexpr RECORD_ALIGN   = 256;
+///the least recently used regions get closed past this many open ones
+Uns constexpr MAX_OPEN_REGIONS = 64;
+///the entries of a region are written by region_flush at the latest, or
+///once this many of them wait for it
+Uns constexpr MAX_PENDING_ENTRIES = 256;
+
+///the records hold a checksum followed by the chunk encoded with
+///codec_encode
+struct RegionSlot {
+    U32 offset;
+    ///0 if the slot holds no record
+    U32 size;
+    U32 cap;
+};
+
+///every chunk has two slots, a new record always goes to the one not in use
+///and the entry is switched only once the record is synced, so the record it
+///points to is never overwritten; the entries do not cross the disk sectors
+struct RegionEntry {
+    Arr<RegionSlot, 2> slots;
+    U32 current;
+    U32 padding[1];
+};
+static_assert(sizeof(RegionEntry) == 32, "the entries have to be aligned");
+
+struct RegionHeader {
+    U32 magic;
+    U32 version;
+    U32 padding[6];
+    Arr<RegionEntry, REGION_VOL> table;
+};
+static_assert(offsetof(RegionHeader, table) == sizeof(RegionEntry),
+              "the table has to be aligned");
+
+struct PendingEntry {
+    Uns         idx;
+    RegionEntry entry;
+};
+
+struct Region {
+    std::mutex   mutex;
+    int          fd;
+    ///the file is mapped as a whole, records appended past the mapping
+    ///cause it to be remapped
+    U8 const*    map = nullptr;
+    SizeT        map_len = 0;
+    SizeT        file_len;
+    RegionHeader header;
+    ///the entries of the records which are not synced yet, the table keeps
+    ///pointing at the older records until they are
+    DynArr<PendingEntry> pending;
+    ///the threads using the region and the time it was last used, both
+    ///guarded by regions_mutex, a region is closed only if nobody uses it
+    Uns          users = 0;
+    U64          last_use;
+};
+
+static char world_path[256];
+static VecMap<ChkPos, Region*> regions;
+static std::mutex regions_mutex;
+static U64 region_clock = 0;
+
+static ChkPos to_region_pos(ChkPos const& pos) {
+    ChkPos r_pos;
+    for(Uns a = 0; a < 3; ++a) {
+        r_pos[a] = (pos[a] >= 0 ? pos[a] : pos[a] - (REGION_SIZE - 1)) /
+            REGION_SIZE;
+    }
+    return r_pos;
+}
+
+static Uns to_region_idx(ChkPos const& pos) {
+    ChkPos idx_pos = pos - to_region_pos(pos) * REGION_SIZE;
+    return idx_pos.x + (idx_pos.y + idx_pos.z * REGION_SIZE) * REGION_SIZE;
+}
+
+static bool write_all(int fd, void const* buff, SizeT len, SizeT offset) {
+    U8 const* iter = (U8 const*)buff;
+    while(len > 0) {
+        ssize_t written = pwrite(fd, iter, len, offset);
+        if(written < 0) {
+            if(errno == EINTR) continue;
+            return false;
+        }
+        iter   += written;
+        len    -= written;
+        offset += written;
+    }
+    return true;
+}
+
+static bool read_all(int fd, void* buff, SizeT len, SizeT offset) {
+    U8* iter = (U8*)buff;
+    while(len > 0) {
+        ssize_t got = pread(fd, iter, len, offset);
+        if(got < 0) {
+            if(errno == EINTR) continue;
+            return false;
+        }
+        if(got == 0) return false;
+        iter   += got;
+        len    -= got;
+        offset += got;
+    }
+    return true;
+}
+
+static U32 get_checksum(U8 const* bytes, SizeT len) {
+    U32 hash = 0x811c9dc5u;
+    for(SizeT i = 0; i < len; ++i) {
+        hash ^= bytes[i];
+        hash *= 0x01000193u;
+    }
+    return hash;
+}
+
+///needs the region mutex locked
+static bool remap_region(Region& region) {
+    if(region.map != nullptr) {
+        munmap((void*)region.map, region.map_len);
+        region.map     = nullptr;
+        region.map_len = 0;
+    }
+    void* map = mmap(nullptr, region.file_len, PROT_READ, MAP_SHARED,
+                     region.fd, 0);
+    if(map == MAP_FAILED) {
+        LUX_LOG_ERR("failed to map a region file: %s", strerror(errno));
+        return false;
+    }
+    region.map     = (U8 const*)map;
+    region.map_len = region.file_len;
+    return true;
+}
+
+static Region* open_region(ChkPos const& r_pos) {
+    char path[256];
+    snprintf(path, sizeof(path), "%s/r.%d.%d.%d.lxr", world_path,
+             (int)r_pos.x, (int)r_pos.y, (int)r_pos.z);
+    int fd = open(path, O_RDWR | O_CREAT, 0644);
+    if(fd < 0) {
+        LUX_LOG_ERR("failed to open region file %s: %s", path, strerror(errno));
+        return nullptr;
+    }
+    Region* region = new Region;
+    region->fd = fd;
+    struct stat st;
+    if(fstat(fd, &st) != 0) {
+        LUX_LOG_ERR("failed to stat region file %s: %s", path, strerror(errno));
+        close(fd);
+        delete region;
+        return nullptr;
+    }
+    if(st.st_size == 0) {
+        std::memset(&region->header, 0, sizeof(RegionHeader));
+        region->header.magic   = REGION_MAGIC;
+        region->header.version = REGION_VERSION;
+        if(!write_all(fd, &region->header, sizeof(RegionHeader), 0)) {
+            LUX_LOG_ERR("failed to initialize region file %s", path);
+        }
+        region->file_len = sizeof(RegionHeader);
+    } else {
+        region->file_len = st.st_size;
+        if(!read_all(fd, &region->header, sizeof(RegionHeader), 0) ||
+           region->header.magic   != REGION_MAGIC ||
+           region->header.version != REGION_VERSION) {
+            LUX_LOG_ERR("invalid region file %s", path);
+            close(fd);
+            delete region;
+            return nullptr;
+        }
+    }
+    remap_region(*region);
+    return region;
+}
+
+///syncs the records written so far and switches the entries to them, needs
+///the region mutex locked
+static void flush_region(Region& region) {
+    if(region.pending.len == 0) return;
+    if(fdatasync(region.fd) != 0) {
+        LUX_LOG_ERR("failed to sync a region: %s", strerror(errno));
+        return;
+    }
+    for(auto const& pending : region.pending) {
+        SizeT entry_offset = offsetof(RegionHeader, table) +
+            pending.idx * sizeof(RegionEntry);
+        if(!write_all(region.fd, &pending.entry, sizeof(RegionEntry),
+                      entry_offset)) {
+            LUX_LOG_ERR("failed to write a region entry: %s", strerror(errno));
+            continue;
+        }
+        region.header.table[pending.idx] = pending.entry;
+    }
+    region.pending.clear();
+}
+
+///the records are made durable before the descriptor goes away, the later
+///region_sync calls do not see it anymore
+static void close_region(Region* region) {
+    {   std::lock_guard<std::mutex> lock(region->mutex);
+        flush_region(*region);
+    }
+    if(region->map != nullptr) {
+        munmap((void*)region->map, region->map_len);
+    }
+    if(fsync(region->fd) != 0) {
+        LUX_LOG_ERR("failed to sync a region: %s", strerror(errno));
+    }
+    close(region->fd);
+    delete region;
+}
+
+///needs regions_mutex locked
+static void close_unused_region() {
+    auto lru = regions.end();
+    for(auto it = regions.begin(); it != regions.end(); ++it) {
+        if(it->second->users > 0) continue;
+        if(lru == regions.end() ||
+           it->second->last_use < lru->second->last_use) {
+            lru = it;
+        }
+    }
+    if(lru == regions.end()) return;
+    close_region(lru->second);
+    regions.erase(lru);
+}
+
+///the region has to be returned with put_region
+static Region* get_region(ChkPos const& pos) {
+    ChkPos r_pos = to_region_pos(pos);
+    std::lock_guard<std::mutex> lock(regions_mutex);
+    if(regions.count(r_pos) == 0) {
+        if(regions.size() >= MAX_OPEN_REGIONS) {
+            close_unused_region();
+        }
+        Region* region = open_region(r_pos);
+        if(region == nullptr) return nullptr;
+        regions[r_pos] = region;
+    }
+    Region* region = regions.at(r_pos);
+    region->users++;
+    region->last_use = region_clock++;
+    return region;
+}
+
+static void put_region(Region* region) {
+    std::lock_guard<std::mutex> lock(regions_mutex);
+    LUX_ASSERT(region->users > 0);
+    region->users--;
+}
+
+static void read_world_meta() {
+    char path[256];
+    snprintf(path, sizeof(path), "%s/world.lxw", world_path);
+    struct WorldMeta {
+        U32 magic;
+        U32 version;
+        U64 seed;
+    } meta;
+    int fd = open(path, O_RDWR | O_CREAT, 0644);
+    if(fd < 0) {
+        LUX_FATAL("failed to open %s: %s", path, strerror(errno));
+    }
+    if(read_all(fd, &meta, sizeof(meta), 0)) {
+        if(meta.magic != WORLD_MAGIC || meta.version != REGION_VERSION) {
+            LUX_FATAL("invalid world file %s", path);
+        }
+        random_seed = meta.seed;
+        LUX_LOG("loaded world with seed %zu", (SizeT)random_seed);
+    } else {
+        meta = {WORLD_MAGIC, REGION_VERSION, random_seed};
+        if(!write_all(fd, &meta, sizeof(meta), 0) || fsync(fd) != 0) {
+            LUX_FATAL("failed to write %s", path);
+        }
+        LUX_LOG("created new world with seed %zu", (SizeT)random_seed);
+    }
+    close(fd);
+}
+
+void region_init(char const* path) {
+    snprintf(world_path, sizeof(world_path), "%s", path);
+    if(mkdir(path, 0755) != 0 && errno != EEXIST) {
+        LUX_FATAL("failed to create world directory %s: %s",
+                  path, strerror(errno));
+    }
+    read_world_meta();
+}
+
+void region_deinit() {
+    std::lock_guard<std::mutex> lock(regions_mutex);
+    for(auto const& pair : regions) {
+        LUX_ASSERT(pair.second->users == 0);
+        close_region(pair.second);
+    }
+    regions.clear();
+}
+
+///the regions are kept open by the returned references, so that the syncs
+///do not need to block the loaders opening new regions
+static void get_open_regions(DynArr<Region*>& out) {
+    std::lock_guard<std::mutex> lock(regions_mutex);
+    for(auto const& pair : regions) {
+        pair.second->users++;
+        out.push(pair.second);
+    }
+}
+
+void region_flush() {
+    DynArr<Region*> open_regions;
+    get_open_regions(open_regions);
+    for(auto const& region : open_regions) {
+        {   std::lock_guard<std::mutex> lock(region->mutex);
+            flush_region(*region);
+        }
+        put_region(region);
+    }
+}
+
+void region_sync() {
+    DynArr<Region*> open_regions;
+    get_open_regions(open_regions);
+    for(auto const& region : open_regions) {
+        {   std::lock_guard<std::mutex> lock(region->mutex);
+            flush_region(*region);
+        }
+        if(fsync(region->fd) != 0) {
+            LUX_LOG_ERR("failed to sync a region: %s", strerror(errno));
+        }
+        put_region(region);
+    }
+}
+
+///needs the region mutex locked
+static bool read_slot(Region& region, RegionSlot const& slot,
+                      Chunk::Data*& data, Block& fill) {
+    if(slot.size < sizeof(U32)) return false;
+    if(slot.offset + slot.size > region.map_len) {
+        if(slot.offset + slot.size > region.file_len ||
+           !remap_region(region)) {
+            return false;
+        }
+    }
+    U8 const* record = region.map + slot.offset;
+    U32 checksum;
+    std::memcpy(&checksum, record, sizeof(U32));
+    if(checksum != get_checksum(record + sizeof(U32),
+                                slot.size - sizeof(U32))) {
+        return false;
+    }
+    return codec_decode(record + sizeof(U32), slot.size - sizeof(U32),
+                        data, fill);
+}
+
+///needs the region mutex locked
+static bool read_chunk(Region& region, ChkPos const& pos,
+                       Chunk::Data*& data, Block& fill) {
+    RegionEntry const& entry = region.header.table[to_region_idx(pos)];
+    RegionSlot const& slot = entry.slots[entry.current];
+    if(slot.size == 0) return false;
+    if(read_slot(region, slot, data, fill)) return true;
+    ///the newest record got corrupted on the disk, the journal has the edits
+    ///made since the older one
+    RegionSlot const& old_slot = entry.slots[1 - entry.current];
+    if(old_slot.size > 0 && read_slot(region, old_slot, data, fill)) {
+        LUX_LOG_WARN("chunk {%d, %d, %d} has an invalid record, "
+                     "using the older one", (int)pos.x, (int)pos.y, (int)pos.z);
+        return true;
+    }
+    LUX_LOG_ERR("chunk {%d, %d, %d} has an invalid record",
+                (int)pos.x, (int)pos.y, (int)pos.z);
+    return false;
+}
+
+bool region_read_chunk(ChkPos const& pos, Chunk::Data*& data, Block& fill) {
+    Region* region = get_region(pos);
+    if(region == nullptr) return false;
+    bool is_stored;
+    {   std::lock_guard<std::mutex> lock(region->mutex);
+        is_stored = read_chunk(*region, pos, data, fill);
+    }
+    put_region(region);
+    return is_stored;
+}
+
+///needs the region mutex locked
+static void write_record(Region* region, ChkPos const& pos,
+                         DynArr<U8> const& record) {
+    U32 size = record.len;
+    Uns idx  = to_region_idx(pos);
+    ///there are few pending entries, so they are searched linearly
+    PendingEntry* pending = nullptr;
+    for(auto& it : region->pending) {
+        if(it.idx == idx) {
+            pending = &it;
+            break;
+        }
+    }
+    RegionEntry entry;
+    if(pending != nullptr) {
+        ///the pending record is not referenced by the table, so it can be
+        ///replaced in place
+        entry = pending->entry;
+    } else {
+        entry = region->header.table[idx];
+        if(entry.slots[entry.current].size != 0) {
+            entry.current = 1 - entry.current;
+        }
+    }
+    RegionSlot& slot = entry.slots[entry.current];
+    if(slot.cap < size) {
+        ///the old record is abandoned, the region files are never compacted
+        slot.offset = region->file_len;
+        slot.cap    = ((size + RECORD_ALIGN - 1) / RECORD_ALIGN) * RECORD_ALIGN;
+        region->file_len += slot.cap;
+    }
+    slot.size = size;
+    if(!write_all(region->fd, record.beg, record.len, slot.offset)) {
+        LUX_LOG_ERR("failed to write chunk {%d, %d, %d}: %s",
+                    (int)pos.x, (int)pos.y, (int)pos.z, strerror(errno));
+        return;
+    }
+    if(pending != nullptr) {
+        pending->entry = entry;
+    } else {
+        region->pending.push({idx, entry});
+    }
+    if(region->pending.len >= MAX_PENDING_ENTRIES) {
+        flush_region(*region);
+    }
+}
+
+void region_write_chunk(ChkPos const& pos, Chunk::Data const* data,
+                        Block const& fill) {
+    static thread_local DynArr<U8> record;
+    record.resize(sizeof(U32));
+    codec_encode(record, data, fill, true);
+    U32 checksum = get_checksum(record.beg + sizeof(U32),
+                                record.len - sizeof(U32));
+    std::memcpy(record.beg, &checksum, sizeof(U32));
+
+    Region* region = get_region(pos);
+    if(region == nullptr) return;
+    {   std::lock_guard<std::mutex> lock(region->mutex);
+        write_record(region, pos, record);
+    }
+    put_region(region);
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <lux_shared/map.hpp>
+//
+#include <map.hpp>
+
+///the chunks are stored in region files of REGION_SIZE^3 chunks each, every
+///file starts with a table of the offsets of its chunks
+ChkCoord constexpr REGION_SIZE = 16;
+
+///creates the world directory if needed, the seed of an existing world
+///replaces random_seed, a new world stores the current one
+void region_init(char const* world_path);
+void region_deinit();
+///syncs the records written so far with one flush per region and makes
+///them visible to region_read_chunk
+void region_flush();
+///also makes the chunks written so far durable, only one thread may call it
+void region_sync();
+
+///returns false if the chunk has not been stored yet, data is set to nullptr
+///if the chunk consists only of fill, otherwise it is allocated with new
+bool region_read_chunk(ChkPos const& pos, Chunk::Data*& data, Block& fill);
+///the chunk might be read as not stored until the next region_flush
+void region_write_chunk(ChkPos const& pos, Chunk::Data const* data,
+                        Block const& fill);
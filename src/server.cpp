@@ -83,6 +83,12 @@ void erase_client(ClientId id) {
     LUX_LOG("    id: %zu" , id);
     auto const& name = server.clients[id].name;
     LUX_LOG("    name: %.*s", (int)name.len, name.beg);
+    for(auto const& pos : server.clients[id].pending_requests) {
+        release_chunk_mesh(pos);
+    }
+    for(auto const& pos : server.clients[id].loaded_chunks) {
+        release_chunk(pos);
+    }
     entity_erase(server.clients[id].entity);
     server.clients.erase(id);
 }
@@ -245,6 +251,14 @@ LUX_MAY_FAIL handle_tick(ENetPeer* peer, ENetPacket *in_pack) {
     return LUX_OK;
 }
 
+///the mesh of a chunk also needs its neighbors on the positive sides
+static bool is_chunk_in_map(ChkPos const& pos) {
+    for(Uns a = 0; a < 3; ++a) {
+        if(pos[a] < -MAX_CHK_COORD - 1 || pos[a] >= MAX_CHK_COORD) return false;
+    }
+    return true;
+}
+
 LUX_MAY_FAIL handle_signal(ENetPeer* peer, ENetPacket* in_pack) {
     NetCsSgnl sgnl;
     LUX_RETHROW(deserialize_packet(in_pack, &sgnl),
@@ -254,8 +268,15 @@ LUX_MAY_FAIL handle_signal(ENetPeer* peer, ENetPacket* in_pack) {
         case NetCsSgnl::MAP_REQUEST: {
             Server::Client& client = get_client(peer);
             for(auto const& request : sgnl.map_request.requests) {
+                if(!is_chunk_in_map(request)) {
+                    LUX_LOG_WARN("client requested a chunk outside the map");
+                    continue;
+                }
+                if(client.pending_requests.count(request) == 0) {
+                    client.pending_requests.insert(request);
+                    request_chunk_mesh(request);
+                }
                 try_guarantee_chunk_mesh(request);
-                client.pending_requests.insert(request);
             }
         } break;
         default: LUX_UNREACHABLE();
@@ -263,6 +284,20 @@ LUX_MAY_FAIL handle_signal(ENetPeer* peer, ENetPacket* in_pack) {
     return LUX_OK;
 }
 
+static void cancel_distant_chunk_requests(Server::Client& client,
+                                          ChkPos const& client_pos) {
+    auto& requests = client.pending_requests;
+    for(auto it = requests.begin(), end = requests.end(); it != end;) {
+        ChkPos diff = abs(*it - client_pos);
+        if(diff.x > MAX_REQUEST_DIST ||
+           diff.y > MAX_REQUEST_DIST ||
+           diff.z > MAX_REQUEST_DIST) {
+            release_chunk_mesh(*it);
+            it = requests.erase(it);
+        } else ++it;
+    }
+}
+
 static void handle_pending_chunk_requests(Server::Client& client) {
     if(client.pending_requests.size() == 0) return;
     ss_sgnl.tag = NetSsSgnl::CHUNK_LOAD;
@@ -290,8 +325,12 @@ static void handle_pending_chunk_requests(Server::Client& client) {
         //we want to be sure that the chunks have been sent,
         //so that there are no chunks that never load
         for(auto const& pos : loaded_chunks) {
-            client.loaded_chunks.emplace(pos);
+            if(client.loaded_chunks.count(pos) == 0) {
+                client.loaded_chunks.insert(pos);
+                hold_chunk(pos);
+            }
             client.pending_requests.erase(pos);
+            release_chunk_mesh(pos);
         }
     } else {
         LUX_LOG_ERR("failed to send map load data to client");
@@ -314,8 +353,7 @@ void server_tick() {
     }
     for(auto const& pos : updated_meshes) {
         auto const& chunk = get_chunk(pos);
-        chunk.mesh->added_faces.clear();
-        chunk.mesh->removed_faces.clear();
+        chunk.mesh->commit_updates();
     }
     });
     updated_meshes.clear();
@@ -360,6 +398,21 @@ void server_tick() {
     }
     });
 
+    { ///load the map around the players first
+        static DynArr<MapPos> focus;
+        focus.clear();
+        for(auto pair : server.clients) {
+            EntityId entity = pair.v.entity;
+            if(entity_comps.physics_body.count(entity) > 0) {
+                auto pos = entity_comps.physics_body.at(entity)->
+                    getCenterOfMassPosition();
+                MapPos map_pos = floor(Vec3F(pos.x(), pos.y(), pos.z()));
+                focus.push(map_pos);
+                cancel_distant_chunk_requests(pair.v, to_chk_pos(map_pos));
+            }
+        }
+        map_set_focus(focus);
+    }
     benchmark("3", 1.0 / 64.0, [&](){
     { ///dispatch ticks and other pending packets
         //@IMPROVE we might want to turn this into a differential transfer,
@@ -0,0 +1,191 @@
+#include <mutex>
+#include <atomic>
+#include <cstring>
+#include <cerrno>
+//
+#include <sys/mman.h>
+//
+#include <lux_shared/common.hpp>
+//
+#include <slab_pool.hpp>
+
+SizeT constexpr SLAB_SIZE      = 2 * 1024 * 1024;
+SizeT constexpr SLAB_OBJ_ALIGN = 16;
+Uns   constexpr SLAB_POOLS_MAX = 16;
+///the longest a thread cache can get, big objects get shorter caches, so
+///that a single thread does not sit on a whole slab
+Uns   constexpr THREAD_CACHE_MAX = 64;
+
+struct FreeObj {
+    FreeObj* next;
+};
+
+///every member is initialized, so that the pools get constant-initialized
+///before any of the static initializers run, which can then create them
+struct SlabPool {
+    char const* name      = nullptr;
+    Uns         id        = 0;
+    SizeT       obj_size  = 0;
+    Uns         cache_len = 0;
+    std::mutex  mutex;
+    FreeObj*    free_list = nullptr;
+    ///the part of the newest slab that was never handed out
+    U8*         slab_iter = nullptr;
+    U8*         slab_end  = nullptr;
+    SizeT       slabs_num = 0;
+    SizeT       huge_slabs_num = 0;
+    std::atomic<SizeT> used_num{0};
+};
+
+static Arr<SlabPool, SLAB_POOLS_MAX> pools;
+static std::atomic<Uns> pools_num{0};
+
+struct ThreadCache {
+    struct FreeList {
+        FreeObj* head = nullptr;
+        Uns      len  = 0;
+    };
+    Arr<FreeList, SLAB_POOLS_MAX> lists;
+    ~ThreadCache();
+};
+static thread_local ThreadCache thread_cache;
+
+static U8* map_slab(bool& is_huge) {
+    void* slab;
+#if LUX_HUGE_PAGES
+    slab = mmap(nullptr, SLAB_SIZE, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if(slab != MAP_FAILED) {
+        is_huge = true;
+        return (U8*)slab;
+    }
+#endif
+    slab = mmap(nullptr, SLAB_SIZE, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(slab == MAP_FAILED) {
+        LUX_FATAL("failed to map a slab: %s", strerror(errno));
+    }
+#if LUX_HUGE_PAGES
+    ///no reserved huge pages, transparent ones might still work
+    madvise(slab, SLAB_SIZE, MADV_HUGEPAGE);
+#endif
+    is_huge = false;
+    return (U8*)slab;
+}
+
+///needs pool.mutex locked
+static FreeObj* take_obj(SlabPool& pool) {
+    if(pool.free_list != nullptr) {
+        FreeObj* obj = pool.free_list;
+        pool.free_list = obj->next;
+        return obj;
+    }
+    if(pool.slab_iter == nullptr ||
+       (SizeT)(pool.slab_end - pool.slab_iter) < pool.obj_size) {
+        bool is_huge;
+        pool.slab_iter = map_slab(is_huge);
+        pool.slab_end  = pool.slab_iter + SLAB_SIZE;
+        pool.slabs_num++;
+        if(is_huge) pool.huge_slabs_num++;
+    }
+    FreeObj* obj = (FreeObj*)pool.slab_iter;
+    pool.slab_iter += pool.obj_size;
+    return obj;
+}
+
+static void refill_cache(SlabPool& pool, ThreadCache::FreeList& cache) {
+    std::lock_guard<std::mutex> lock(pool.mutex);
+    while(cache.len < (pool.cache_len + 1) / 2) {
+        FreeObj* obj = take_obj(pool);
+        obj->next  = cache.head;
+        cache.head = obj;
+        cache.len++;
+    }
+}
+
+static void flush_cache(SlabPool& pool, ThreadCache::FreeList& cache,
+                        Uns keep_len) {
+    std::lock_guard<std::mutex> lock(pool.mutex);
+    while(cache.len > keep_len) {
+        FreeObj* obj = cache.head;
+        cache.head = obj->next;
+        cache.len--;
+        obj->next = pool.free_list;
+        pool.free_list = obj;
+    }
+}
+
+ThreadCache::~ThreadCache() {
+    Uns len = pools_num.load();
+    for(Uns i = 0; i < len; ++i) {
+        if(lists[i].len > 0) flush_cache(pools[i], lists[i], 0);
+    }
+}
+
+SlabPool* slab_pool_create(char const* name, SizeT obj_size) {
+    Uns id = pools_num.load();
+    LUX_ASSERT(id < SLAB_POOLS_MAX);
+    SlabPool& pool = pools[id];
+    pool.name      = name;
+    pool.id        = id;
+    pool.obj_size  = ((max(obj_size, sizeof(FreeObj)) + SLAB_OBJ_ALIGN - 1) /
+                      SLAB_OBJ_ALIGN) * SLAB_OBJ_ALIGN;
+    LUX_ASSERT(pool.obj_size <= SLAB_SIZE);
+    pool.cache_len = max((SizeT)2, min((SizeT)THREAD_CACHE_MAX,
+                                       SLAB_SIZE / pool.obj_size / 8));
+    pools_num.store(id + 1);
+    return &pool;
+}
+
+void* slab_alloc(SlabPool* pool) {
+    auto& cache = thread_cache.lists[pool->id];
+    if(cache.head == nullptr) {
+        refill_cache(*pool, cache);
+    }
+    FreeObj* obj = cache.head;
+    cache.head = obj->next;
+    cache.len--;
+    pool->used_num.fetch_add(1, std::memory_order_relaxed);
+    return obj;
+}
+
+void slab_free(SlabPool* pool, void* ptr) {
+    if(ptr == nullptr) return;
+    auto& cache = thread_cache.lists[pool->id];
+    FreeObj* obj = (FreeObj*)ptr;
+    obj->next  = cache.head;
+    cache.head = obj;
+    cache.len++;
+    pool->used_num.fetch_sub(1, std::memory_order_relaxed);
+    if(cache.len > pool->cache_len) {
+        flush_cache(*pool, cache, pool->cache_len / 2);
+    }
+}
+
+void slab_get_stats(DynArr<SlabPoolStats>& out) {
+    Uns len = pools_num.load();
+    out.resize(len);
+    for(Uns i = 0; i < len; ++i) {
+        SlabPool& pool = pools[i];
+        std::lock_guard<std::mutex> lock(pool.mutex);
+        out[i].name           = pool.name;
+        out[i].obj_size       = pool.obj_size;
+        out[i].slabs_num      = pool.slabs_num;
+        out[i].huge_slabs_num = pool.huge_slabs_num;
+        out[i].used_num       = pool.used_num.load();
+        out[i].cap_num        = pool.slabs_num * (SLAB_SIZE / pool.obj_size);
+    }
+}
+
+void slab_log_stats() {
+    DynArr<SlabPoolStats> stats;
+    slab_get_stats(stats);
+    LUX_LOG("slab pool stats");
+    for(auto const& pool : stats) {
+        F64 occupancy = pool.cap_num > 0 ?
+            (F64)pool.used_num / (F64)pool.cap_num * 100.0 : 0.0;
+        LUX_LOG("    %s: %zu/%zu used (%.1f%%), %zu slabs, %zu huge",
+                pool.name, pool.used_num, pool.cap_num, occupancy,
+                pool.slabs_num, pool.huge_slabs_num);
+    }
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <lux_shared/common.hpp>
+
+///objects of a fixed size are allocated from big slabs, which are never given
+///back to the system; freed objects go to a small per-thread cache first, so
+///that the workers rarely touch the shared free list
+struct SlabPool;
+
+struct SlabPoolStats {
+    char const* name;
+    SizeT obj_size;
+    SizeT slabs_num;
+    ///the slabs which got backed by huge pages
+    SizeT huge_slabs_num;
+    ///objects handed out and not freed yet
+    SizeT used_num;
+    ///objects which fit in all the slabs
+    SizeT cap_num;
+};
+
+///can be called from static initializers
+SlabPool* slab_pool_create(char const* name, SizeT obj_size);
+void* slab_alloc(SlabPool* pool);
+void  slab_free(SlabPool* pool, void* ptr);
+
+void slab_get_stats(DynArr<SlabPoolStats>& out);
+void slab_log_stats();